@@ -4,6 +4,7 @@
 #include <fstream>
 #include <string>
 #include <map>
+#include <set>
 #include <vector>
 #include <tuple>
 #include <memory>
@@ -16,6 +17,35 @@
 #include <condition_variable>
 #include <atomic>
 #include <chrono>
+#include <deque>
+#include <array>
+#include <sstream>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <cmath>
+#include <climits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include <curl/curl.h>
 #include <ncurses.h>
@@ -27,165 +57,3982 @@
 #define MINIAUDIO_IMPLEMENTATION
 #include "../include/miniaudio.h"
 
-using json = nlohmann::json;
+using json = nlohmann::json;
+
+const std::string VERSION = "2.0";
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Locked memory
+// ─────────────────────────────────────────────────────────────────────────────
+//
+// mlock works on whole pages and does not nest, so two objects that share a
+// page (a track slot and its neighbour on the heap, the ring) would unlock
+// each other. Pages are counted here and only unlocked with their last user.
+
+static std::mutex locked_pages_mutex;
+static std::map<uintptr_t, unsigned> locked_pages;     // page address -> ranges holding it
+
+static uintptr_t page_size() {
+    static const uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    return page;
+}
+
+static std::pair<uintptr_t, uintptr_t> page_span(const void* addr, size_t len) {
+    uintptr_t page = page_size();
+    uintptr_t first = reinterpret_cast<uintptr_t>(addr) & ~(page - 1);
+    uintptr_t end = (reinterpret_cast<uintptr_t>(addr) + len + page - 1) & ~(page - 1);
+    return {first, end};
+}
+
+static bool lock_pages(const void* addr, size_t len) {
+    if (!len) return false;
+    auto [first, end] = page_span(addr, len);
+    std::lock_guard<std::mutex> lock(locked_pages_mutex);
+    if (mlock(reinterpret_cast<void*>(first), end - first) != 0) return false;
+    for (uintptr_t p = first; p < end; p += page_size()) ++locked_pages[p];
+    return true;
+}
+
+// Undoes one successful lock_pages() of the same range.
+static void unlock_pages(const void* addr, size_t len) {
+    if (!len) return;
+    auto [first, end] = page_span(addr, len);
+    std::lock_guard<std::mutex> lock(locked_pages_mutex);
+    uintptr_t run = 0;                                  // start of the pages to munlock, 0 for none
+    for (uintptr_t p = first; p <= end; p += page_size()) {
+        bool release = false;
+        if (p < end) {
+            auto it = locked_pages.find(p);
+            if (it != locked_pages.end() && --it->second == 0) {
+                locked_pages.erase(it);
+                release = true;
+            }
+        }
+        if (release && !run) run = p;
+        if (!release && run) {
+            munlock(reinterpret_cast<void*>(run), p - run);
+            run = 0;
+        }
+    }
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Lock-free PCM ring (single producer: decode thread, single consumer: device)
+// ─────────────────────────────────────────────────────────────────────────────
+
+class PcmRing {
+private:
+    std::vector<float> buffer;
+    size_t mask = 0;
+    bool locked = false;
+    alignas(64) std::atomic<size_t> head{0};  // total samples written
+    alignas(64) std::atomic<size_t> tail{0};  // total samples read
+
+public:
+    ~PcmRing() {
+        if (locked) unlock_pages(buffer.data(), bytes());
+    }
+
+    // Not thread-safe: only call while neither side is running.
+    void reset(size_t min_samples) {
+        if (locked) unlock_pages(buffer.data(), bytes());
+        locked = false;
+        size_t cap = 1;
+        while (cap < min_samples) cap <<= 1;
+        buffer.assign(cap, 0.0f);
+        mask = cap - 1;
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    void clear() {
+        tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    // Pins the samples in RAM so the callback never takes a page fault.
+    // Not thread-safe, like reset().
+    bool lock_memory() {
+        if (!locked) locked = lock_pages(buffer.data(), bytes());
+        return locked;
+    }
+
+    size_t bytes() const { return buffer.size() * sizeof(float); }
+
+    size_t write_count() const { return head.load(std::memory_order_relaxed); }  // producer side
+    size_t read_count() const  { return tail.load(std::memory_order_acquire); }
+
+    size_t readable() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+    }
+
+    size_t writable() const {
+        return buffer.size() - (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+    }
+
+    size_t write(const float* src, size_t count) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        count = std::min(count, buffer.size() - (h - t));
+        size_t pos = h & mask;
+        size_t first = std::min(count, buffer.size() - pos);
+        std::copy(src, src + first, buffer.data() + pos);
+        std::copy(src + first, src + count, buffer.data());
+        head.store(h + count, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer side: drops everything queued before `pos` (a write_count()).
+    void skip_to(size_t pos) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (pos > t && pos <= head.load(std::memory_order_acquire)) {
+            tail.store(pos, std::memory_order_release);
+        }
+    }
+
+    size_t read(float* dst, size_t count) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+        count = std::min(count, h - t);
+        size_t pos = t & mask;
+        size_t first = std::min(count, buffer.size() - pos);
+        std::copy(buffer.data() + pos, buffer.data() + pos + first, dst);
+        std::copy(buffer.data(), buffer.data() + (count - first), dst + first);
+        tail.store(t + count, std::memory_order_release);
+        return count;
+    }
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Gain stage (SIMD kernels with a scalar tail; AVX2 when built for it)
+// ─────────────────────────────────────────────────────────────────────────────
+
+// Volume slider position (0-100) to linear gain on a dB scale.
+static constexpr float VOLUME_RANGE_DB = 40.0f;
+
+static float volume_to_gain(int vol) {
+    if (vol <= 0) return 0.0f;
+    if (vol >= 100) return 1.0f;
+    float db = -VOLUME_RANGE_DB * (1.0f - vol / 100.0f);
+    return std::pow(10.0f, db / 20.0f);
+}
+
+// samples[i] *= gain
+static void apply_gain(float* samples, size_t count, float gain) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256 g8 = _mm256_set1_ps(gain);
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(samples + i, _mm256_mul_ps(_mm256_loadu_ps(samples + i), g8));
+    }
+#elif defined(__SSE2__)
+    __m128 g4 = _mm_set1_ps(gain);
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), g4));
+    }
+#endif
+    for (; i < count; ++i) samples[i] *= gain;
+}
+
+// samples[i] *= from + (to - from) * i / count, so a volume change is spread
+// over the whole block instead of stepping at its start.
+static void apply_gain_ramp(float* samples, size_t count, float from, float to) {
+    if (count == 0) return;
+    const float step = (to - from) / count;
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256 g8 = _mm256_add_ps(_mm256_set1_ps(from),
+                              _mm256_mul_ps(_mm256_set1_ps(step), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7)));
+    __m256 inc8 = _mm256_set1_ps(step * 8);
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(samples + i, _mm256_mul_ps(_mm256_loadu_ps(samples + i), g8));
+        g8 = _mm256_add_ps(g8, inc8);
+    }
+#elif defined(__SSE2__)
+    __m128 g4 = _mm_add_ps(_mm_set1_ps(from), _mm_mul_ps(_mm_set1_ps(step), _mm_setr_ps(0, 1, 2, 3)));
+    __m128 inc4 = _mm_set1_ps(step * 4);
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), g4));
+        g4 = _mm_add_ps(g4, inc4);
+    }
+#endif
+    for (; i < count; ++i) samples[i] *= from + step * i;
+}
+
+// dst[i] = a[i] * ramp(a_from, a_to) + b[i] * ramp(b_from, b_to); dst may alias a or b.
+static void mix_gain_ramps(float* dst, const float* a, const float* b, size_t count,
+                           float a_from, float a_to, float b_from, float b_to) {
+    if (count == 0) return;
+    const float a_step = (a_to - a_from) / count, b_step = (b_to - b_from) / count;
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256 lanes = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 ga = _mm256_add_ps(_mm256_set1_ps(a_from), _mm256_mul_ps(_mm256_set1_ps(a_step), lanes));
+    __m256 gb = _mm256_add_ps(_mm256_set1_ps(b_from), _mm256_mul_ps(_mm256_set1_ps(b_step), lanes));
+    __m256 inc_a = _mm256_set1_ps(a_step * 8), inc_b = _mm256_set1_ps(b_step * 8);
+    for (; i + 8 <= count; i += 8) {
+        __m256 mixed = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(a + i), ga),
+                                     _mm256_mul_ps(_mm256_loadu_ps(b + i), gb));
+        _mm256_storeu_ps(dst + i, mixed);
+        ga = _mm256_add_ps(ga, inc_a);
+        gb = _mm256_add_ps(gb, inc_b);
+    }
+#elif defined(__SSE2__)
+    const __m128 lanes = _mm_setr_ps(0, 1, 2, 3);
+    __m128 ga = _mm_add_ps(_mm_set1_ps(a_from), _mm_mul_ps(_mm_set1_ps(a_step), lanes));
+    __m128 gb = _mm_add_ps(_mm_set1_ps(b_from), _mm_mul_ps(_mm_set1_ps(b_step), lanes));
+    __m128 inc_a = _mm_set1_ps(a_step * 4), inc_b = _mm_set1_ps(b_step * 4);
+    for (; i + 4 <= count; i += 4) {
+        __m128 mixed = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a + i), ga), _mm_mul_ps(_mm_loadu_ps(b + i), gb));
+        _mm_storeu_ps(dst + i, mixed);
+        ga = _mm_add_ps(ga, inc_a);
+        gb = _mm_add_ps(gb, inc_b);
+    }
+#endif
+    for (; i < count; ++i) dst[i] = a[i] * (a_from + a_step * i) + b[i] * (b_from + b_step * i);
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Download buffer pool (recycled between tracks, capacity kept)
+// ─────────────────────────────────────────────────────────────────────────────
+
+// A buffer handed out stays owned by whoever holds the shared_ptr (in the end
+// the TrackSlot whose decoder reads it) and comes back here with its capacity
+// intact when the last reference goes, so the next track reuses the pages.
+class BufferPool {
+private:
+    struct Shelf {
+        std::mutex mtx;
+        std::vector<std::unique_ptr<std::vector<char>>> free;
+        size_t free_bytes = 0;
+        size_t max_bytes;
+    };
+    std::shared_ptr<Shelf> shelf;
+
+    static void give_back(Shelf& s, std::vector<char>* buf) {
+        std::unique_ptr<std::vector<char>> owned(buf);
+        std::lock_guard<std::mutex> lock(s.mtx);
+        if (s.free_bytes + owned->capacity() > s.max_bytes) return;
+        s.free_bytes += owned->capacity();
+        s.free.push_back(std::move(owned));
+    }
+
+public:
+    explicit BufferPool(size_t max_retained_bytes) : shelf(std::make_shared<Shelf>()) {
+        shelf->max_bytes = max_retained_bytes;
+    }
+
+    // An empty buffer with at least `size_hint` bytes reserved.
+    std::shared_ptr<std::vector<char>> acquire(size_t size_hint) {
+        std::unique_ptr<std::vector<char>> buf;
+        {
+            std::lock_guard<std::mutex> lock(shelf->mtx);
+            // The smallest buffer that fits, otherwise the largest so that a
+            // single reserve() grows it. Without a hint (a transcode, say) the
+            // largest too, so the body reallocates as little as possible.
+            auto best = shelf->free.end();
+            for (auto it = shelf->free.begin(); it != shelf->free.end(); ++it) {
+                if (best == shelf->free.end()) { best = it; continue; }
+                size_t cap = (*it)->capacity(), best_cap = (*best)->capacity();
+                bool fits = size_hint && cap >= size_hint, best_fits = size_hint && best_cap >= size_hint;
+                if ((fits && (!best_fits || cap < best_cap)) || (!fits && !best_fits && cap > best_cap)) best = it;
+            }
+            if (best != shelf->free.end()) {
+                shelf->free_bytes -= (*best)->capacity();
+                buf = std::move(*best);
+                shelf->free.erase(best);
+            }
+        }
+        if (!buf) buf = std::make_unique<std::vector<char>>();
+        buf->clear();
+        if (buf->capacity() < size_hint) buf->reserve(size_hint);
+
+        std::weak_ptr<Shelf> home = shelf;
+        return std::shared_ptr<std::vector<char>>(buf.release(), [home](std::vector<char>* v) {
+            if (auto s = home.lock()) give_back(*s, v);
+            else delete v;
+        });
+    }
+};
+
+// curl sink that takes its buffer from the pool on the first write, reserved
+// to Content-Length so the body lands without a single reallocation.
+struct PooledDownload {
+    BufferPool* pool;
+    CURL* curl;
+    std::shared_ptr<std::vector<char>> data;
+
+    explicit PooledDownload(BufferPool* pool, CURL* curl = nullptr) : pool(pool), curl(curl) {}
+
+    size_t size() const { return data ? data->size() : 0; }
+
+    size_t append(const char* bytes, size_t len) {
+        if (!data) {
+            curl_off_t expected = -1;
+            if (curl) curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &expected);
+            data = pool->acquire(expected > 0 ? static_cast<size_t>(expected) : 0);
+        }
+        data->insert(data->end(), bytes, bytes + len);
+        return len;
+    }
+
+    static size_t write_callback(void* contents, size_t size, size_t nmemb, void* userp) {
+        return static_cast<PooledDownload*>(userp)->append(static_cast<char*>(contents), size * nmemb);
+    }
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Shared HTTP client (one curl_multi I/O thread over pooled easy handles)
+// ─────────────────────────────────────────────────────────────────────────────
+
+// Every transfer borrows an easy handle from here and runs on a single I/O
+// thread that drives a curl_multi; the borrowing thread only waits for the
+// result. Transfers to the same host share connections (one multiplexed
+// HTTP/2 connection where the server offers it), and DNS results and TLS
+// sessions are kept in a CURLSH, so a request that follows another one skips
+// the lookup and the handshakes. Callbacks run on the I/O thread and must not
+// block: a sink that is full returns CURL_WRITEFUNC_PAUSE and calls resume()
+// once it has room again.
+class HttpClient {
+public:
+    static constexpr long CONNECT_TIMEOUT_MS   = 10000;
+    static constexpr long API_TIMEOUT_MS       = 30000;   // JSON calls; media transfers take as long as they take
+    static constexpr long MAX_HOST_CONNECTIONS = 6;       // further transfers queue, or share an HTTP/2 connection
+    static constexpr size_t MAX_IDLE_HANDLES   = 8;
+
+    // A borrowed handle; goes back to the pool when the lease ends. A lease
+    // that ends with its transfer still running cancels it first.
+    class Lease {
+    public:
+        Lease(HttpClient* owner, CURL* curl) : owner(owner), curl(curl) {}
+        Lease(Lease&& other) noexcept
+          : owner(other.owner), curl(other.curl), running(std::move(other.running)) { other.curl = nullptr; }
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        ~Lease() {
+            if (!curl) return;
+            if (running.valid() && running.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                owner->cancel(curl);
+                running.wait();
+            }
+            owner->release(curl);
+        }
+
+        CURL* get() const { return curl; }
+
+        // Hands the configured handle to the I/O thread. `on_done` runs there
+        // as the transfer ends, before the future is ready; it must not block.
+        std::shared_future<CURLcode> start(std::function<void(CURLcode)> on_done = nullptr) {
+            running = owner->submit(curl, std::move(on_done));
+            return running;
+        }
+
+        CURLcode perform() {
+            CURLcode res = start().get();
+            running = {};
+            return res;
+        }
+
+    private:
+        HttpClient* owner;
+        CURL* curl;
+        std::shared_future<CURLcode> running;
+    };
+
+    HttpClient() {
+        curl_global_init(CURL_GLOBAL_DEFAULT);     // reference counted; pairs with the destructor
+        share = curl_share_init();
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lock_share);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlock_share);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        multi = curl_multi_init();
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, MAX_HOST_CONNECTIONS);
+        io = std::thread(&HttpClient::run, this);
+    }
+
+    ~HttpClient() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            io_exit = true;
+        }
+        curl_multi_wakeup(multi);
+        io.join();
+        curl_multi_cleanup(multi);
+        for (CURL* curl : idle) curl_easy_cleanup(curl);
+        curl_share_cleanup(share);
+        curl_global_cleanup();
+    }
+
+    // A handle with the shared defaults applied. `timeout_ms` caps the whole
+    // transfer, 0 for none.
+    Lease acquire(long timeout_ms = 0) {
+        CURL* curl = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!idle.empty()) {
+                curl = idle.back();
+                idle.pop_back();
+            }
+        }
+        if (!curl) curl = curl_easy_init();
+        if (curl) {
+            curl_easy_setopt(curl, CURLOPT_SHARE, share);
+            curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+            curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+            curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);      // wait to multiplex rather than open another connection
+            curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, CONNECT_TIMEOUT_MS);
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+            curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        }
+        return Lease(this, curl);
+    }
+
+    // Unpauses a transfer whose write callback returned CURL_WRITEFUNC_PAUSE.
+    // Any thread; a no-op once the transfer is over.
+    void resume(CURL* curl) { post(Command::RESUME, curl); }
+
+    // Ends a running transfer; its future completes with CURLE_ABORTED_BY_CALLBACK.
+    void cancel(CURL* curl) { post(Command::CANCEL, curl); }
+
+    // Request count, new connections and mean/max connect and first-byte
+    // times, empty before the first request.
+    std::vector<std::string> report() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!stats.requests) return {};
+        char line[96];
+        std::vector<std::string> lines;
+        snprintf(line, sizeof(line), "HTTP requests: %llu, new connections: %llu",
+                 static_cast<unsigned long long>(stats.requests), static_cast<unsigned long long>(stats.connects));
+        lines.push_back(line);
+        if (stats.connects) {
+            snprintf(line, sizeof(line), "  Connect: mean %.1f ms, max %.1f ms",
+                     stats.connect_us / 1000.0 / stats.connects, stats.max_connect_us / 1000.0);
+            lines.push_back(line);
+        }
+        snprintf(line, sizeof(line), "  First byte: mean %.1f ms, max %.1f ms",
+                 stats.ttfb_us / 1000.0 / stats.requests, stats.max_ttfb_us / 1000.0);
+        lines.push_back(line);
+        return lines;
+    }
+
+private:
+    struct Stats {
+        uint64_t requests = 0;
+        uint64_t connects = 0;          // transfers that could not reuse a connection
+        double connect_us = 0, max_connect_us = 0;     // TCP plus TLS handshake
+        double ttfb_us = 0, max_ttfb_us = 0;
+    };
+
+    struct Transfer {
+        std::promise<CURLcode> done;
+        std::function<void(CURLcode)> on_done;
+    };
+
+    struct Command {
+        enum Kind { ADD, RESUME, CANCEL } kind;
+        CURL* curl;
+        Transfer transfer;              // ADD only
+    };
+
+    CURLSH* share;
+    std::array<std::mutex, CURL_LOCK_DATA_LAST> share_locks;
+    CURLM* multi;
+    std::thread io;
+    mutable std::mutex mtx;
+    std::vector<CURL*> idle;
+    std::vector<Command> commands;      // for the I/O thread
+    bool io_exit = false;
+    Stats stats;
+    std::map<CURL*, Transfer> running;  // I/O thread only
+
+    static void lock_share(CURL*, curl_lock_data data, curl_lock_access, void* userp) {
+        static_cast<HttpClient*>(userp)->share_locks[data].lock();
+    }
+
+    static void unlock_share(CURL*, curl_lock_data data, void* userp) {
+        static_cast<HttpClient*>(userp)->share_locks[data].unlock();
+    }
+
+    std::shared_future<CURLcode> submit(CURL* curl, std::function<void(CURLcode)> on_done) {
+        Transfer transfer{{}, std::move(on_done)};
+        std::shared_future<CURLcode> result = transfer.done.get_future().share();
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            commands.push_back({Command::ADD, curl, std::move(transfer)});
+        }
+        curl_multi_wakeup(multi);
+        return result;
+    }
+
+    void post(Command::Kind kind, CURL* curl) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            commands.push_back({kind, curl, {}});
+        }
+        curl_multi_wakeup(multi);
+    }
+
+    // The reset drops options and callback pointers but keeps the handle's
+    // buffers; the connection itself stays with the multi.
+    void release(CURL* curl) {
+        curl_easy_reset(curl);
+        std::lock_guard<std::mutex> lock(mtx);
+        if (idle.size() < MAX_IDLE_HANDLES) idle.push_back(curl);
+        else curl_easy_cleanup(curl);
+    }
+
+    void run() {
+        std::vector<Command> batch;
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (io_exit) break;
+                batch.swap(commands);
+            }
+            for (auto& c : batch) {
+                if (c.kind == Command::ADD) {
+                    if (curl_multi_add_handle(multi, c.curl) == CURLM_OK) {
+                        running.emplace(c.curl, std::move(c.transfer));
+                    } else {
+                        if (c.transfer.on_done) c.transfer.on_done(CURLE_FAILED_INIT);
+                        c.transfer.done.set_value(CURLE_FAILED_INIT);
+                    }
+                    continue;
+                }
+                auto it = running.find(c.curl);
+                if (it == running.end()) continue;
+                if (c.kind == Command::RESUME) curl_easy_pause(c.curl, CURLPAUSE_CONT);
+                else complete(it, CURLE_ABORTED_BY_CALLBACK);
+            }
+            batch.clear();
+
+            int active = 0, queued = 0;
+            curl_multi_perform(multi, &active);
+            while (CURLMsg* msg = curl_multi_info_read(multi, &queued)) {
+                if (msg->msg != CURLMSG_DONE) continue;
+                auto it = running.find(msg->easy_handle);
+                if (it != running.end()) complete(it, msg->data.result);
+            }
+            // With nothing in flight only a command can make work, and
+            // submit() and post() wake the poll for those.
+            curl_multi_poll(multi, nullptr, 0, running.empty() ? INT_MAX : 1000, nullptr);
+        }
+        while (!running.empty()) complete(running.begin(), CURLE_ABORTED_BY_CALLBACK);
+    }
+
+    void complete(std::map<CURL*, Transfer>::iterator it, CURLcode res) {
+        CURL* curl = it->first;
+        curl_multi_remove_handle(multi, curl);
+        record(curl);
+        if (it->second.on_done) it->second.on_done(res);
+        it->second.done.set_value(res);
+        running.erase(it);
+    }
+
+    void record(CURL* curl) {
+        curl_off_t connect = 0, tls = 0, first_byte = 0;
+        long connects = 0;
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+        curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+        curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+        curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+        std::lock_guard<std::mutex> lock(mtx);
+        ++stats.requests;
+        stats.ttfb_us += first_byte;
+        stats.max_ttfb_us = std::max<double>(stats.max_ttfb_us, first_byte);
+        if (connects > 0) {
+            double handshake = std::max(connect, tls);
+            ++stats.connects;
+            stats.connect_us += handshake;
+            stats.max_connect_us = std::max(stats.max_connect_us, handshake);
+        }
+    }
+};
+
+// Created on first use and shared by the player's workers and the API calls.
+static HttpClient& http_client() {
+    static HttpClient client;
+    return client;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Progressive download buffer (producer: curl, consumer: decoder read callback)
+// ─────────────────────────────────────────────────────────────────────────────
+
+class StreamBuffer {
+private:
+    std::shared_ptr<std::vector<char>> window;  // byte at absolute offset o lives at o % window->size()
+    size_t keep_behind;             // bytes kept behind the read cursor for decoder seeks
+    uint64_t base = 0;              // oldest byte still held
+    uint64_t write_pos = 0;
+    uint64_t read_pos = 0;
+    int64_t content_length = -1;
+    bool finished = false;
+    bool failed = false;
+    bool cancelled = false;
+    int64_t restart_from = -1;      // a seek left the window; the producer refetches from here
+    bool reader_waiting = false;
+    bool producer_paused = false;   // a write was refused for lack of room
+    std::function<void()> wake_producer;
+    std::function<void()> on_finish;
+    unsigned stalls = 0;
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+
+    bool at_end() const { return finished || cancelled; }
+
+    // Free bytes once everything more than keep_behind behind the reader is dropped.
+    size_t room() const {
+        uint64_t droppable = read_pos > keep_behind ? read_pos - keep_behind : 0;
+        return window->size() - (write_pos - std::max(base, droppable));
+    }
+
+    // The wakeup to call, after unlocking, for a producer that should retry.
+    std::function<void()> producer_to_wake(bool force) {
+        if (!producer_paused && !force) return nullptr;
+        if (!force && room() < std::min<size_t>(RESUME_BYTES, window->size() / 4)) return nullptr;
+        producer_paused = false;
+        return wake_producer;
+    }
+
+    // Drops the window and parks every cursor at `target`; bytes arrive again
+    // once the producer has re-requested the stream from there.
+    void jump(uint64_t target) {
+        base = write_pos = read_pos = target;
+        restart_from = static_cast<int64_t>(target);
+        finished = false;
+        failed = false;
+        cv.notify_all();
+    }
+
+public:
+    // A seek further than this past what has arrived is cheaper to serve with
+    // a fresh Range request than by waiting for the bytes in between.
+    static constexpr uint64_t JUMP_AHEAD_BYTES = 256 * 1024;
+
+    // A paused producer is woken once this much room has opened up.
+    static constexpr size_t RESUME_BYTES = 64 * 1024;
+
+    // `storage` is typically a pooled buffer; it is resized to `capacity`.
+    StreamBuffer(std::shared_ptr<std::vector<char>> storage, size_t capacity, size_t keep)
+      : window(std::move(storage)), keep_behind(std::min(keep, capacity / 2)) {
+        window->resize(capacity);
+    }
+
+    // Producer side, never blocks: takes all of `len` or nothing. Refuses once
+    // cancelled or after a jump, so that curl aborts the transfer, and while
+    // the window is full, after which the producer pauses until woken.
+    bool write(const char* data, size_t len) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (cancelled || restart_from >= 0) return false;
+        if (room() < len) {
+            producer_paused = true;
+            return false;
+        }
+        if (write_pos + len - base > window->size()) base = read_pos - keep_behind;     // room() counted on this
+        size_t done = 0;
+        while (done < len) {
+            size_t pos = write_pos % window->size();
+            size_t n = std::min(len - done, window->size() - pos);
+            std::copy(data + done, data + done + n, window->data() + pos);
+            write_pos += n;
+            done += n;
+        }
+        cv.notify_all();
+        return true;
+    }
+
+    // Called when a refused producer should try again: room has opened up,
+    // or the stream was cancelled or jumped. Must not block.
+    void set_producer_wakeup(std::function<void()> wake) {
+        std::lock_guard<std::mutex> lock(mtx);
+        wake_producer = std::move(wake);
+    }
+
+    // Called, outside the lock, once the download has completed or failed.
+    void set_finish_callback(std::function<void()> callback) {
+        std::lock_guard<std::mutex> lock(mtx);
+        on_finish = std::move(callback);
+    }
+
+    void set_content_length(int64_t len) {
+        std::lock_guard<std::mutex> lock(mtx);
+        content_length = len;
+    }
+
+    // Ignored while a jump is pending: the transfer that ended was for bytes
+    // the reader no longer wants.
+    void finish(bool ok) {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (restart_from >= 0) return;
+        finished = true;
+        failed = !ok;
+        cv.notify_all();
+        auto callback = on_finish;
+        lock.unlock();
+        if (callback) callback();
+    }
+
+    // Consumer side. Blocks until `len` bytes are available or the stream ends;
+    // decoders treat a short read as end of file.
+    size_t read(void* dst, size_t len) {
+        std::unique_lock<std::mutex> lock(mtx);
+        char* out = static_cast<char*>(dst);
+        size_t done = 0;
+        while (done < len) {
+            if (read_pos >= write_pos) {
+                if (at_end()) break;
+                reader_waiting = true;
+                ++stalls;
+                cv.wait(lock, [&]{ return read_pos < write_pos || at_end(); });
+                reader_waiting = false;
+                continue;
+            }
+            size_t pos = read_pos % window->size();
+            size_t n = std::min<uint64_t>({len - done, write_pos - read_pos, window->size() - pos});
+            std::copy(window->data() + pos, window->data() + pos + n, out + done);
+            read_pos += n;
+            done += n;
+        }
+        cv.notify_all();
+        auto wake = producer_to_wake(false);
+        lock.unlock();
+        if (wake) wake();
+        return done;
+    }
+
+    bool seek(int64_t offset, ma_seek_origin origin) {
+        std::unique_lock<std::mutex> lock(mtx);
+        int64_t target = offset;
+        if (origin == ma_seek_origin_current) target += static_cast<int64_t>(read_pos);
+        else if (origin == ma_seek_origin_end) {
+            // Decoders probe the tail for tags; don't make them wait for the
+            // whole download to do so.
+            if (content_length < 0 || !finished) return false;
+            target += content_length;
+        }
+        if (target < 0 || (content_length >= 0 && target > content_length)) return false;
+        uint64_t t = static_cast<uint64_t>(target);
+        if (cancelled) return false;
+        // Outside the window, or far enough ahead: refetch from the target.
+        if (t < base || (t > write_pos + JUMP_AHEAD_BYTES && !finished)) {
+            jump(t);
+            auto wake = producer_to_wake(true);
+            lock.unlock();
+            if (wake) wake();
+            return true;
+        }
+        cv.wait(lock, [&]{ return t <= write_pos || at_end(); });
+        if (t > write_pos) return false;
+        read_pos = t;
+        cv.notify_all();
+        return true;
+    }
+
+    // Waits until `bytes` have arrived or the transfer is over. Returns false if
+    // nothing usable arrived.
+    bool wait_for_bytes(uint64_t bytes) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&]{ return write_pos >= bytes || at_end(); });
+        return !cancelled && write_pos > 0 && !(failed && write_pos < bytes);
+    }
+
+    void cancel() {
+        std::unique_lock<std::mutex> lock(mtx);
+        cancelled = true;
+        cv.notify_all();
+        auto wake = producer_to_wake(true);
+        lock.unlock();
+        if (wake) wake();
+    }
+
+    bool is_cancelled() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return cancelled;
+    }
+
+    // True when the running transfer should stop: cancelled, or superseded by a jump.
+    bool is_interrupted() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return cancelled || restart_from >= 0;
+    }
+
+    // Producer side: the offset to re-request from after a jump, or -1.
+    int64_t take_restart() {
+        std::lock_guard<std::mutex> lock(mtx);
+        int64_t from = restart_from;
+        restart_from = -1;
+        return from;
+    }
+
+    // Producer side, between transfers. Returns false once cancelled, true
+    // when a jump is pending or `timeout` ran out.
+    template <class Duration>
+    bool wait_for_restart(Duration timeout) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait_for(lock, timeout, [&]{ return cancelled || restart_from >= 0; });
+        return !cancelled;
+    }
+
+    bool wait_for_restart() {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&]{ return cancelled || restart_from >= 0; });
+        return !cancelled;
+    }
+
+    bool is_stalled() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return reader_waiting && !at_end();
+    }
+
+    unsigned stall_count() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return stalls;
+    }
+
+    uint64_t bytes_received() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return write_pos;
+    }
+
+    uint64_t bytes_read() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return read_pos;
+    }
+
+    int64_t length() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return content_length;
+    }
+
+    bool is_complete() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return finished;
+    }
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// MP3 decoding backend on the standalone dr_mp3
+// ─────────────────────────────────────────────────────────────────────────────
+//
+// miniaudio's bundled MP3 decoder ignores the LAME/Xing header, so every track
+// keeps its encoder delay and padding and consecutive tracks never line up.
+// dr_mp3 trims both, so MP3 content is routed through it as a custom backend.
+
+struct Mp3Backend {
+    ma_data_source_base ds;     // must be first: miniaudio casts this struct to its base
+    drmp3 mp3;
+    ma_read_proc onRead;
+    ma_seek_proc onSeek;
+    ma_tell_proc onTell;
+    void* pReadSeekTellUserData;
+};
+
+static size_t mp3_backend_read_bytes(void* pUserData, void* pBufferOut, size_t bytesToRead) {
+    auto* b = static_cast<Mp3Backend*>(pUserData);
+    size_t bytesRead = 0;
+    b->onRead(b->pReadSeekTellUserData, pBufferOut, bytesToRead, &bytesRead);
+    return bytesRead;
+}
+
+static drmp3_bool32 mp3_backend_seek_bytes(void* pUserData, int offset, drmp3_seek_origin origin) {
+    auto* b = static_cast<Mp3Backend*>(pUserData);
+    ma_seek_origin o = origin == DRMP3_SEEK_CUR ? ma_seek_origin_current
+                     : origin == DRMP3_SEEK_END ? ma_seek_origin_end
+                     : ma_seek_origin_start;
+    return b->onSeek(b->pReadSeekTellUserData, offset, o) == MA_SUCCESS;
+}
+
+static drmp3_bool32 mp3_backend_tell_bytes(void* pUserData, drmp3_int64* pCursor) {
+    auto* b = static_cast<Mp3Backend*>(pUserData);
+    ma_int64 cursor = 0;
+    if (!b->onTell || b->onTell(b->pReadSeekTellUserData, &cursor) != MA_SUCCESS) return DRMP3_FALSE;
+    *pCursor = cursor;
+    return DRMP3_TRUE;
+}
+
+static ma_result mp3_ds_read(ma_data_source* pDataSource, void* pFramesOut, ma_uint64 frameCount, ma_uint64* pFramesRead) {
+    auto* b = static_cast<Mp3Backend*>(pDataSource);
+    ma_uint64 n = drmp3_read_pcm_frames_f32(&b->mp3, frameCount, static_cast<float*>(pFramesOut));
+    if (pFramesRead) *pFramesRead = n;
+    return n == 0 ? MA_AT_END : MA_SUCCESS;
+}
+
+// dr_mp3 positions count the encoder delay; everything outside this backend
+// works in trimmed frames.
+static ma_result mp3_ds_seek(ma_data_source* pDataSource, ma_uint64 frameIndex) {
+    auto* b = static_cast<Mp3Backend*>(pDataSource);
+    ma_uint64 raw = frameIndex == 0 ? 0 : frameIndex + b->mp3.delayInPCMFrames;
+    return drmp3_seek_to_pcm_frame(&b->mp3, raw) ? MA_SUCCESS : MA_ERROR;
+}
+
+static ma_result mp3_ds_get_data_format(ma_data_source* pDataSource, ma_format* pFormat, ma_uint32* pChannels,
+                                        ma_uint32* pSampleRate, ma_channel* pChannelMap, size_t channelMapCap) {
+    auto* b = static_cast<Mp3Backend*>(pDataSource);
+    if (pFormat)     *pFormat     = ma_format_f32;
+    if (pChannels)   *pChannels   = b->mp3.channels;
+    if (pSampleRate) *pSampleRate = b->mp3.sampleRate;
+    if (pChannelMap) ma_channel_map_init_standard(ma_standard_channel_map_default, pChannelMap, channelMapCap, b->mp3.channels);
+    return MA_SUCCESS;
+}
+
+static ma_result mp3_ds_get_cursor(ma_data_source* pDataSource, ma_uint64* pCursor) {
+    auto* b = static_cast<Mp3Backend*>(pDataSource);
+    ma_uint64 delay = b->mp3.delayInPCMFrames;
+    *pCursor = b->mp3.currentPCMFrame > delay ? b->mp3.currentPCMFrame - delay : 0;
+    return MA_SUCCESS;
+}
+
+static ma_result mp3_ds_get_length(ma_data_source* pDataSource, ma_uint64* pLength) {
+    auto* b = static_cast<Mp3Backend*>(pDataSource);
+    *pLength = 0;
+    if (b->mp3.totalPCMFrameCount != DRMP3_UINT64_MAX) {
+        ma_uint64 trim = ma_uint64(b->mp3.delayInPCMFrames) + b->mp3.paddingInPCMFrames;
+        *pLength = b->mp3.totalPCMFrameCount > trim ? b->mp3.totalPCMFrameCount - trim : 0;
+        return MA_SUCCESS;
+    }
+    // Without a Xing header the length needs a full scan, which is only cheap
+    // when the whole file is already in memory.
+    if (b->mp3.memory.pData == nullptr) return MA_NOT_IMPLEMENTED;
+    *pLength = drmp3_get_pcm_frame_count(&b->mp3);
+    return MA_SUCCESS;
+}
+
+static ma_data_source_vtable g_mp3_ds_vtable = {
+    mp3_ds_read,
+    mp3_ds_seek,
+    mp3_ds_get_data_format,
+    mp3_ds_get_cursor,
+    mp3_ds_get_length,
+    nullptr,    // onSetLooping
+    0
+};
+
+static Mp3Backend* mp3_backend_alloc() {
+    auto b = std::make_unique<Mp3Backend>();
+    ma_data_source_config dsConfig = ma_data_source_config_init();
+    dsConfig.vtable = &g_mp3_ds_vtable;
+    if (ma_data_source_init(&dsConfig, &b->ds) != MA_SUCCESS) return nullptr;
+    return b.release();
+}
+
+static void mp3_backend_free(Mp3Backend* b) {
+    ma_data_source_uninit(&b->ds);
+    delete b;
+}
+
+static ma_result mp3_backend_init(void*, ma_read_proc onRead, ma_seek_proc onSeek, ma_tell_proc onTell,
+                                  void* pReadSeekTellUserData, const ma_decoding_backend_config*,
+                                  const ma_allocation_callbacks*, ma_data_source** ppBackend) {
+    Mp3Backend* b = mp3_backend_alloc();
+    if (!b) return MA_OUT_OF_MEMORY;
+    b->onRead = onRead;
+    b->onSeek = onSeek;
+    b->onTell = onTell;
+    b->pReadSeekTellUserData = pReadSeekTellUserData;
+    if (!drmp3_init(&b->mp3, mp3_backend_read_bytes, mp3_backend_seek_bytes, mp3_backend_tell_bytes,
+                    nullptr, b, nullptr)) {
+        mp3_backend_free(b);
+        return MA_INVALID_FILE;
+    }
+    *ppBackend = b;
+    return MA_SUCCESS;
+}
+
+static ma_result mp3_backend_init_memory(void*, const void* pData, size_t dataSize, const ma_decoding_backend_config*,
+                                         const ma_allocation_callbacks*, ma_data_source** ppBackend) {
+    Mp3Backend* b = mp3_backend_alloc();
+    if (!b) return MA_OUT_OF_MEMORY;
+    if (!drmp3_init_memory(&b->mp3, pData, dataSize, nullptr)) {
+        mp3_backend_free(b);
+        return MA_INVALID_FILE;
+    }
+    *ppBackend = b;
+    return MA_SUCCESS;
+}
+
+static void mp3_backend_uninit(void*, ma_data_source* pBackend, const ma_allocation_callbacks*) {
+    auto* b = static_cast<Mp3Backend*>(pBackend);
+    drmp3_uninit(&b->mp3);
+    mp3_backend_free(b);
+}
+
+static ma_decoding_backend_vtable g_mp3_backend_vtable = {
+    mp3_backend_init,
+    nullptr,    // onInitFile
+    nullptr,    // onInitFileW
+    mp3_backend_init_memory,
+    mp3_backend_uninit
+};
+
+static ma_decoding_backend_vtable* g_custom_backends[] = { &g_mp3_backend_vtable };
+
+// Jellyfin may transcode what it serves from /universal, in which case byte
+// offsets do not map to time and a position is asked for in StartTimeTicks.
+static bool is_universal(const std::string& url) {
+    return url.find("/universal?") != std::string::npos;
+}
+
+// Source container of a stream URL: direct streams name it in the path
+// (/Audio/{id}/stream.flac), everything else is transcoded to MP3.
+static std::string url_container(const std::string& url) {
+    auto p = url.find("/stream.");
+    if (p == std::string::npos) return "mp3";
+    p += 8;
+    return url.substr(p, url.find_first_of("?/", p) - p);
+}
+
+// Hints the decoder at the container so FLAC and WAV go straight to
+// miniaudio's own decoders instead of being probed as MP3 first.
+static ma_decoder_config decoder_config_for(const std::string& url, ma_uint32 channels, ma_uint32 rate) {
+    ma_decoder_config config = ma_decoder_config_init(ma_format_f32, channels, rate);
+    std::string container = url_container(url);
+    if (container == "flac") {
+        config.encodingFormat = ma_encoding_format_flac;
+    } else if (container == "wav") {
+        config.encodingFormat = ma_encoding_format_wav;
+    } else {
+        config.ppCustomBackendVTables = g_custom_backends;
+        config.customBackendCount = sizeof(g_custom_backends) / sizeof(g_custom_backends[0]);
+    }
+    return config;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// On-disk audio cache (LRU, size-capped, one file per track + transcode)
+// ─────────────────────────────────────────────────────────────────────────────
+
+// Read-only mapping of a cached file; the decoder reads straight from it.
+class MappedFile {
+private:
+    void* addr = nullptr;
+    size_t len = 0;
+
+public:
+    static std::shared_ptr<MappedFile> open(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+        struct stat st;
+        std::shared_ptr<MappedFile> m;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                m = std::make_shared<MappedFile>();
+                m->addr = p;
+                m->len = st.st_size;
+            }
+        }
+        ::close(fd);
+        return m;
+    }
+
+    ~MappedFile() {
+        if (addr) munmap(addr, len);
+    }
+
+    const char* data() const { return static_cast<const char*>(addr); }
+    size_t size() const { return len; }
+};
+
+class AudioCache {
+private:
+    struct Entry {
+        uint64_t size;
+        int64_t last_used;      // seconds since epoch, mirrored to the file mtime
+    };
+
+    std::string dir;
+    uint64_t max_bytes;
+    uint64_t total_bytes = 0;
+    std::map<std::string, Entry> index;     // file name -> entry
+    std::mutex mtx;
+    std::atomic<unsigned> hits{0};
+    std::atomic<unsigned> misses{0};
+    std::atomic<unsigned> tmp_serial{0};
+
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // Stream URLs carry the host and a per-session api_key; the cache only
+    // cares about the item id and the transcode parameters.
+    static std::string key_for(const std::string& url) {
+        std::string k = url;
+        auto scheme = k.find("://");
+        if (scheme != std::string::npos) {
+            auto path = k.find("/Audio/", scheme + 3);
+            if (path != std::string::npos) k = k.substr(path);
+        }
+        auto q = k.find('?');
+        if (q == std::string::npos) return k;
+        std::string path = k.substr(0, q), query, param;
+        std::stringstream params(k.substr(q + 1));
+        while (std::getline(params, param, '&')) {
+            if (param.rfind("api_key=", 0) == 0) continue;
+            query += (query.empty() ? "?" : "&") + param;
+        }
+        return path + query;
+    }
+
+    static std::string file_name(const std::string& url) {
+        uint64_t h = 1469598103934665603ULL;       // FNV-1a
+        for (unsigned char c : key_for(url)) { h ^= c; h *= 1099511628211ULL; }
+        char buf[24];
+        snprintf(buf, sizeof(buf), "%016llx.audio", (unsigned long long)h);
+        return buf;
+    }
+
+    std::string path_of(const std::string& name) const {
+        return dir + "/" + name;
+    }
+
+    // Caller holds mtx.
+    void evict_to(uint64_t budget, const std::string& keep) {
+        while (total_bytes > budget) {
+            auto victim = index.end();
+            for (auto it = index.begin(); it != index.end(); ++it) {
+                if (it->first == keep) continue;
+                if (victim == index.end() || it->second.last_used < victim->second.last_used) victim = it;
+            }
+            if (victim == index.end()) return;
+            ::unlink(path_of(victim->first).c_str());
+            total_bytes -= victim->second.size;
+            index.erase(victim);
+        }
+    }
+
+public:
+    // Streams a download into a temporary file that only becomes visible to
+    // lookups once commit() renames it into place.
+    class Writer {
+    private:
+        AudioCache* cache;
+        std::string url, name, tmp_path;
+        int fd;
+        uint64_t written = 0;
+        bool failed = false;
+
+    public:
+        Writer(AudioCache* c, const std::string& u) : cache(c), url(u), name(file_name(u)) {
+            tmp_path = cache->path_of(name) + ".tmp" + std::to_string(::getpid()) + "." + std::to_string(cache->tmp_serial++);
+            fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            failed = fd < 0;
+        }
+
+        ~Writer() {
+            if (fd >= 0) {
+                ::close(fd);
+                ::unlink(tmp_path.c_str());
+            }
+        }
+
+        void append(const char* data, size_t len) {
+            if (failed) return;
+            written += len;
+            if (written > cache->max_bytes) { failed = true; return; }
+            while (len > 0) {
+                ssize_t n = ::write(fd, data, len);
+                if (n <= 0) { failed = true; return; }
+                data += n;
+                len -= n;
+            }
+        }
+
+        bool commit() {
+            if (failed || written == 0) return false;
+            bool ok = ::fsync(fd) == 0;
+            ok = ::close(fd) == 0 && ok;
+            fd = -1;
+            if (!ok || ::rename(tmp_path.c_str(), cache->path_of(name).c_str()) != 0) {
+                ::unlink(tmp_path.c_str());
+                return false;
+            }
+            {
+                std::lock_guard<std::mutex> lock(cache->mtx);
+                auto it = cache->index.find(name);
+                if (it != cache->index.end()) cache->total_bytes -= it->second.size;
+                cache->index[name] = {written, now()};
+                cache->total_bytes += written;
+                cache->evict_to(cache->max_bytes, name);
+            }
+            if (cache->on_commit) cache->on_commit(url);
+            return true;
+        }
+    };
+
+    AudioCache(const std::string& directory, uint64_t max) : dir(directory), max_bytes(max) {
+        if (max_bytes == 0) return;
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        for (auto& f : std::filesystem::directory_iterator(dir, ec)) {
+            std::string name = f.path().filename().string();
+            if (name.find(".tmp") != std::string::npos) {
+                std::filesystem::remove(f.path(), ec);   // left over from an interrupted write
+                continue;
+            }
+            if (f.path().extension() != ".audio") continue;
+            struct stat st;
+            if (::stat(f.path().c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            index[name] = {static_cast<uint64_t>(st.st_size), static_cast<int64_t>(st.st_mtime)};
+            total_bytes += st.st_size;
+        }
+        evict_to(max_bytes, "");
+    }
+
+    // Called after a track lands in the cache; set before any downloads start.
+    std::function<void(const std::string& url)> on_commit;
+
+    bool enabled() const { return max_bytes > 0; }
+
+    bool contains(const std::string& url) {
+        if (!enabled()) return false;
+        std::lock_guard<std::mutex> lock(mtx);
+        return index.count(file_name(url)) > 0;
+    }
+
+    // Maps a cached track and marks it most recently used. Counts as a hit or miss.
+    std::shared_ptr<MappedFile> open(const std::string& url) {
+        if (!enabled()) return nullptr;
+        std::string name = file_name(url);
+        std::shared_ptr<MappedFile> m;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto it = index.find(name);
+            if (it != index.end()) {
+                m = MappedFile::open(path_of(name));
+                if (m) {
+                    it->second.last_used = now();
+                    ::utimensat(AT_FDCWD, path_of(name).c_str(), nullptr, 0);
+                } else {
+                    total_bytes -= it->second.size;
+                    index.erase(it);
+                }
+            }
+        }
+        (m ? hits : misses)++;
+        return m;
+    }
+
+    // Maps a cached track without touching its recency or the counters.
+    std::shared_ptr<MappedFile> peek(const std::string& url) {
+        if (!enabled()) return nullptr;
+        std::string name = file_name(url);
+        std::lock_guard<std::mutex> lock(mtx);
+        return index.count(name) ? MappedFile::open(path_of(name)) : nullptr;
+    }
+
+    std::unique_ptr<Writer> writer(const std::string& url) {
+        if (!enabled()) return nullptr;
+        return std::make_unique<Writer>(this, url);
+    }
+
+    void store(const std::string& url, const std::vector<char>& data) {
+        auto w = writer(url);
+        if (!w) return;
+        w->append(data.data(), data.size());
+        w->commit();
+    }
+
+    unsigned hit_count() const { return hits; }
+    unsigned miss_count() const { return misses; }
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Loudness analysis (ITU-R BS.1770 / EBU R128) on idle-priority workers
+// ─────────────────────────────────────────────────────────────────────────────
+
+// Integrated loudness and true peak of one track. K-weighting runs in double
+// precision with channel pairs sharing an SSE2 register.
+class LoudnessMeter {
+public:
+    static constexpr unsigned MAX_CHANNELS = 8;     // wider layouts are not measured
+
+private:
+    static constexpr unsigned TP_PHASES = 4;        // 4x oversampling for true peak
+    static constexpr unsigned TP_TAPS = 12;         // taps per phase
+
+    struct Biquad { double b0, b1, b2, a1, a2; };
+
+    unsigned channels;
+    Biquad shelf, highpass;
+    alignas(16) double state[4][MAX_CHANNELS] = {};  // z1/z2 of both filters, per channel
+    alignas(16) double energy[MAX_CHANNELS] = {};    // sum of squares in the current 100 ms step
+    double weights[MAX_CHANNELS];
+    size_t step_frames, step_fill = 0;
+    std::vector<double> steps;                       // weighted mean square per 100 ms step
+    std::vector<double> blocks;                      // 400 ms gating blocks, 75% overlap
+
+    float taps[TP_PHASES][TP_TAPS];
+    float history[MAX_CHANNELS][TP_TAPS] = {};
+    float peak = 0.0f;
+
+    // One TDF-II biquad step for lanes [c, c+1].
+#if defined(__SSE2__)
+    static __m128d biquad(const Biquad& f, __m128d x, double* z1, double* z2) {
+        __m128d y  = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(f.b0), x), _mm_load_pd(z1));
+        __m128d n1 = _mm_sub_pd(_mm_add_pd(_mm_mul_pd(_mm_set1_pd(f.b1), x), _mm_load_pd(z2)),
+                                _mm_mul_pd(_mm_set1_pd(f.a1), y));
+        __m128d n2 = _mm_sub_pd(_mm_mul_pd(_mm_set1_pd(f.b2), x), _mm_mul_pd(_mm_set1_pd(f.a2), y));
+        _mm_store_pd(z1, n1);
+        _mm_store_pd(z2, n2);
+        return y;
+    }
+#else
+    static double biquad(const Biquad& f, double x, double& z1, double& z2) {
+        double y = f.b0 * x + z1;
+        z1 = f.b1 * x + z2 - f.a1 * y;
+        z2 = f.b2 * x - f.a2 * y;
+        return y;
+    }
+#endif
+
+    void track_peak(const float* frame) {
+        for (unsigned c = 0; c < channels; ++c) {
+            float* h = history[c];
+            std::memmove(h + 1, h, (TP_TAPS - 1) * sizeof(float));
+            h[0] = frame[c];
+            for (unsigned p = 0; p < TP_PHASES; ++p) {
+                float acc = 0.0f;
+                for (unsigned k = 0; k < TP_TAPS; ++k) acc += taps[p][k] * h[k];
+                peak = std::max(peak, std::fabs(acc));
+            }
+        }
+    }
+
+    // BS.1770 weight of a channel position: surrounds in the 60-120 degree
+    // band (side, and the back pair that 5.1 FLAC uses for them) count 1.41,
+    // the LFE not at all, everything else 1.0.
+    static double channel_weight(ma_channel position) {
+        switch (position) {
+        case MA_CHANNEL_LFE:
+            return 0.0;
+        case MA_CHANNEL_SIDE_LEFT: case MA_CHANNEL_SIDE_RIGHT:
+        case MA_CHANNEL_BACK_LEFT: case MA_CHANNEL_BACK_RIGHT:
+            return 1.41;
+        default:
+            return 1.0;
+        }
+    }
+
+    void close_step() {
+        double z = 0.0;
+        for (unsigned c = 0; c < channels; ++c) {
+            z += weights[c] * energy[c] / step_frames;
+            energy[c] = 0.0;
+        }
+        steps.push_back(z);
+        step_fill = 0;
+        if (steps.size() >= 4) {
+            size_t n = steps.size();
+            blocks.push_back((steps[n - 1] + steps[n - 2] + steps[n - 3] + steps[n - 4]) / 4.0);
+        }
+    }
+
+public:
+    // `map` gives each channel's position; null means the standard layout
+    // for the channel count, which is at most MAX_CHANNELS.
+    LoudnessMeter(unsigned ch, unsigned sample_rate, const ma_channel* map = nullptr) : channels(std::min(ch, MAX_CHANNELS)) {
+        // Coefficients for an arbitrary rate, as derived in libebur128.
+        const double pi = 3.14159265358979323846;
+        double K  = std::tan(pi * 1681.974450955533 / sample_rate);
+        double Vh = std::pow(10.0, 3.999843853973347 / 20.0);
+        double Vb = std::pow(Vh, 0.4996667741545416);
+        double Q  = 0.7071752369554196;
+        double a0 = 1.0 + K / Q + K * K;
+        shelf = {(Vh + Vb * K / Q + K * K) / a0, 2.0 * (K * K - Vh) / a0, (Vh - Vb * K / Q + K * K) / a0,
+                 2.0 * (K * K - 1.0) / a0, (1.0 - K / Q + K * K) / a0};
+        K  = std::tan(pi * 38.13547087602444 / sample_rate);
+        Q  = 0.5003270373238773;
+        a0 = 1.0 + K / Q + K * K;
+        highpass = {1.0, -2.0, 1.0, 2.0 * (K * K - 1.0) / a0, (1.0 - K / Q + K * K) / a0};
+
+        ma_channel standard[MAX_CHANNELS];
+        if (!map) {
+            ma_channel_map_init_standard(ma_standard_channel_map_default, standard, MAX_CHANNELS, channels);
+            map = standard;
+        }
+        for (unsigned c = 0; c < MAX_CHANNELS; ++c) weights[c] = c < channels ? channel_weight(map[c]) : 0.0;
+        step_frames = std::max(1u, sample_rate / 10);
+
+        // Hann-windowed sinc interpolator, split into polyphase branches.
+        const unsigned N = TP_PHASES * TP_TAPS;
+        for (unsigned n = 0; n < N; ++n) {
+            double t = (n - (N - 1) / 2.0) / TP_PHASES;
+            double sinc = t == 0.0 ? 1.0 : std::sin(pi * t) / (pi * t);
+            double window = 0.5 - 0.5 * std::cos(2.0 * pi * (n + 0.5) / N);
+            taps[n % TP_PHASES][n / TP_PHASES] = float(sinc * window);
+        }
+    }
+
+    void add(const float* samples, size_t frames) {
+        alignas(16) double x[MAX_CHANNELS] = {};
+        for (size_t f = 0; f < frames; ++f) {
+            const float* frame = samples + f * channels;
+            for (unsigned c = 0; c < channels; ++c) x[c] = frame[c];
+#if defined(__SSE2__)
+            for (unsigned c = 0; c < channels; c += 2) {
+                __m128d v = biquad(shelf, _mm_load_pd(x + c), state[0] + c, state[1] + c);
+                v = biquad(highpass, v, state[2] + c, state[3] + c);
+                _mm_store_pd(energy + c, _mm_add_pd(_mm_load_pd(energy + c), _mm_mul_pd(v, v)));
+            }
+#else
+            for (unsigned c = 0; c < channels; ++c) {
+                double v = biquad(shelf, x[c], state[0][c], state[1][c]);
+                v = biquad(highpass, v, state[2][c], state[3][c]);
+                energy[c] += v * v;
+            }
+#endif
+            track_peak(frame);
+            if (++step_fill == step_frames) close_step();
+        }
+    }
+
+    // LUFS after the absolute (-70) and relative (-10 LU) gates; -70 for silence.
+    double integrated() const {
+        auto lufs = [](double z) { return -0.691 + 10.0 * std::log10(z); };
+        const double abs_gate = std::pow(10.0, (-70.0 + 0.691) / 10.0);
+        double sum = 0.0;
+        size_t n = 0;
+        for (double z : blocks) if (z > abs_gate) { sum += z; ++n; }
+        if (n == 0) return -70.0;
+        double rel_gate = std::pow(10.0, (lufs(sum / n) - 10.0 + 0.691) / 10.0);
+        sum = 0.0;
+        n = 0;
+        for (double z : blocks) if (z > abs_gate && z > rel_gate) { sum += z; ++n; }
+        return n ? lufs(sum / n) : -70.0;
+    }
+
+    float true_peak() const { return peak; }
+};
+
+// Analyses cached tracks in the background and keeps the results, keyed by
+// Jellyfin item id, in loudness.json next to the cache.
+class LoudnessAnalyzer {
+public:
+    struct Result {
+        double lufs;
+        double peak;        // linear true peak
+    };
+
+    // Bytes of a complete track plus whatever keeps them alive.
+    struct Source {
+        std::shared_ptr<const void> owner;
+        const char* data = nullptr;
+        size_t size = 0;
+    };
+    using SourceFn = std::function<Source(const std::string& url)>;
+
+private:
+    std::string path;
+    SourceFn source;
+    std::map<std::string, Result> results;      // item id -> result
+    std::set<std::string> queued_ids;           // pending or failed, never retried this run
+    std::deque<std::pair<std::string, std::string>> jobs;   // (id, url)
+    std::vector<std::thread> workers;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::atomic<bool> exiting{false};
+
+    // SCHED_IDLE only gets CPU nobody else wants, so the pool can never delay
+    // the decode thread; nice 19 is the fallback where it is unavailable.
+    static void lower_priority() {
+#if defined(__linux__)
+        sched_param param{};
+        if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) == 0) return;
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+#endif
+    }
+
+    void load() {
+        std::ifstream in(path);
+        if (!in) return;
+        json j = json::parse(in, nullptr, false);
+        if (!j.is_object()) return;
+        for (auto& [id, r] : j.items()) {
+            if (r.is_object()) results[id] = {r.value("lufs", -70.0), r.value("peak", 1.0)};
+        }
+    }
+
+    // Caller holds mtx. Written whole and renamed so a crash keeps the old table.
+    void save() {
+        json j = json::object();
+        for (auto& [id, r] : results) j[id] = {{"lufs", r.lufs}, {"peak", r.peak}};
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            if (!out) return;
+            out << j.dump();
+            if (!out.flush()) return;
+        }
+        std::rename(tmp.c_str(), path.c_str());
+    }
+
+    bool analyse(const std::string& url, const Source& src, Result& out) {
+        ma_decoder_config config = decoder_config_for(url, 0, 0);
+        ma_decoder decoder;
+        if (ma_decoder_init_memory(src.data, src.size, &config, &decoder) != MA_SUCCESS) return false;
+        if (decoder.outputChannels > LoudnessMeter::MAX_CHANNELS) {
+            // Metering only some of the channels would under-read the track.
+            ma_decoder_uninit(&decoder);
+            return false;
+        }
+
+        ma_channel map[MA_MAX_CHANNELS];
+        ma_decoder_get_data_format(&decoder, nullptr, nullptr, nullptr, map, MA_MAX_CHANNELS);
+        LoudnessMeter meter(decoder.outputChannels, decoder.outputSampleRate, map);
+        std::vector<float> chunk(4096 * decoder.outputChannels);
+        ma_uint64 read = 0, total = 0;
+        do {
+            ma_decoder_read_pcm_frames(&decoder, chunk.data(), 4096, &read);
+            meter.add(chunk.data(), static_cast<size_t>(read));
+            total += read;
+        } while (read == 4096 && !exiting);
+        ma_decoder_uninit(&decoder);
+        if (exiting || total == 0) return false;
+
+        out = {meter.integrated(), meter.true_peak()};
+        return true;
+    }
+
+    void run() {
+        lower_priority();
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true) {
+            cv.wait(lock, [&]{ return exiting || !jobs.empty(); });
+            if (exiting) return;
+            auto [id, url] = jobs.front();
+            jobs.pop_front();
+            lock.unlock();
+
+            Result r;
+            Source src = source(url);
+            bool ok = src.data && analyse(url, src, r);
+
+            lock.lock();
+            if (ok) {
+                results[id] = r;
+                save();
+            } else if (!src.data) {
+                queued_ids.erase(id);   // not downloaded yet; the cache commit re-requests it
+            }
+        }
+    }
+
+public:
+    LoudnessAnalyzer(const std::string& dir, unsigned threads, SourceFn fn)
+      : path(dir + "/loudness.json"), source(std::move(fn)) {
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        load();
+        for (unsigned i = 0; i < threads; ++i) workers.emplace_back(&LoudnessAnalyzer::run, this);
+    }
+
+    ~LoudnessAnalyzer() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            exiting = true;
+        }
+        cv.notify_all();
+        for (auto& t : workers) t.join();
+    }
+
+    // Item id from a /Audio/{id}/ stream URL.
+    static std::string item_id(const std::string& url) {
+        auto p = url.find("/Audio/");
+        if (p == std::string::npos) return "";
+        p += 7;
+        return url.substr(p, url.find('/', p) - p);
+    }
+
+    // Queues a track unless it has been measured or tried already.
+    void request(const std::string& url) {
+        std::string id = item_id(url);
+        if (id.empty() || workers.empty()) return;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (results.count(id) || queued_ids.count(id)) return;
+            queued_ids.insert(id);
+            jobs.emplace_back(id, url);
+        }
+        cv.notify_one();
+    }
+
+    bool lookup(const std::string& url, Result& out) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = results.find(item_id(url));
+        if (it == results.end()) return false;
+        out = it->second;
+        return true;
+    }
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Prefetcher: downloads upcoming queue entries in the background
+// ─────────────────────────────────────────────────────────────────────────────
+
+class Prefetcher {
+public:
+    enum State { NONE, FETCHING, READY };
+
+private:
+    struct Entry {
+        std::shared_ptr<const std::vector<char>> data;
+        bool skipped = false;   // failed or did not fit; not retried while wanted
+    };
+
+    size_t max_bytes;
+    AudioCache* cache;                          // already-cached tracks need no prefetch
+    BufferPool* pool;
+    std::vector<std::string> wanted;            // priority order, highest first
+    std::map<std::string, Entry> entries;       // finished downloads
+    size_t held_bytes = 0;
+    std::string active_url;
+    std::atomic<bool> cancel_active{false};
+    bool exit_requested = false;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::thread worker;
+
+    size_t priority_of(const std::string& url) const {
+        return std::find(wanted.begin(), wanted.end(), url) - wanted.begin();
+    }
+
+    // Frees lower-priority downloads until `needed` more bytes fit under the cap.
+    bool make_room(size_t needed, size_t priority) {
+        while (held_bytes + needed > max_bytes) {
+            auto victim = entries.end();
+            size_t worst = priority;
+            for (auto it = entries.begin(); it != entries.end(); ++it) {
+                size_t p = priority_of(it->first);
+                if (it->second.data && p > worst) { worst = p; victim = it; }
+            }
+            if (victim == entries.end()) return false;
+            held_bytes -= victim->second.data->size();
+            entries.erase(victim);
+        }
+        return true;
+    }
+
+    struct Transfer {
+        Prefetcher* self;
+        PooledDownload download;
+        size_t priority;
+        bool over_budget;
+    };
+
+    static size_t write_callback(void* contents, size_t size, size_t nmemb, void* userp) {
+        auto* xfer = static_cast<Transfer*>(userp);
+        size_t total = size * nmemb;
+        {
+            std::lock_guard<std::mutex> lock(xfer->self->mtx);
+            if (!xfer->self->make_room(xfer->download.size() + total, xfer->priority)) {
+                xfer->over_budget = true;
+                return 0;
+            }
+        }
+        return xfer->download.append(static_cast<char*>(contents), total);
+    }
+
+    static int progress_callback(void* clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+        return static_cast<Prefetcher*>(clientp)->cancel_active ? 1 : 0;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (!exit_requested) {
+            auto pick = std::find_if(wanted.begin(), wanted.end(),
+                                     [&](const std::string& u){ return !entries.count(u) && !cache->contains(u); });
+            if (pick == wanted.end()) {
+                cv.wait(lock);
+                continue;
+            }
+
+            std::string url = *pick;
+            active_url = url;
+            cancel_active = false;
+            Transfer xfer{this, PooledDownload{pool}, priority_of(url), false};
+            lock.unlock();
+
+            CURLcode res = CURLE_FAILED_INIT;
+            if (auto http = http_client().acquire(); CURL* curl = http.get()) {
+                xfer.download.curl = curl;
+                curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+                curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+                curl_easy_setopt(curl, CURLOPT_WRITEDATA, &xfer);
+                curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+                curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progress_callback);
+                curl_easy_setopt(curl, CURLOPT_XFERINFODATA, this);
+                res = http.perform();
+            }
+
+            lock.lock();
+            active_url.clear();
+            bool still_wanted = priority_of(url) < wanted.size();
+            std::shared_ptr<std::vector<char>> data = std::move(xfer.download.data);
+            if (res == CURLE_OK && data && !data->empty()) {
+                lock.unlock();
+                cache->store(url, *data);
+                lock.lock();
+            }
+            if (res == CURLE_OK && data && !data->empty() && still_wanted && make_room(data->size(), priority_of(url))) {
+                held_bytes += data->size();
+                entries[url].data = std::move(data);
+            } else if (still_wanted && !cancel_active) {
+                entries[url].skipped = true;
+            }
+        }
+    }
+
+public:
+    Prefetcher(size_t max, AudioCache* c, BufferPool* p) : max_bytes(max), cache(c), pool(p) {
+        worker = std::thread(&Prefetcher::run, this);
+    }
+
+    ~Prefetcher() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            exit_requested = true;
+            cancel_active = true;
+        }
+        cv.notify_all();
+        worker.join();
+    }
+
+    // Replaces the list of tracks to keep fetched, highest priority first.
+    // Anything that dropped off the list is cancelled or released.
+    void set_wanted(std::vector<std::string> urls) {
+        std::lock_guard<std::mutex> lock(mtx);
+        wanted = std::move(urls);
+        for (auto it = entries.begin(); it != entries.end(); ) {
+            if (priority_of(it->first) < wanted.size()) { ++it; continue; }
+            if (it->second.data) held_bytes -= it->second.data->size();
+            it = entries.erase(it);
+        }
+        if (!active_url.empty() && priority_of(active_url) >= wanted.size()) cancel_active = true;
+        cv.notify_all();
+    }
+
+    std::shared_ptr<const std::vector<char>> lookup(const std::string& url) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = entries.find(url);
+        return it != entries.end() ? it->second.data : nullptr;
+    }
+
+    State state(const std::string& url) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (url == active_url) return FETCHING;
+        auto it = entries.find(url);
+        return ((it != entries.end() && it->second.data) || cache->contains(url)) ? READY : NONE;
+    }
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Speculative head fetch (the track under the cursor, before Enter is pressed)
+// ─────────────────────────────────────────────────────────────────────────────
+
+// Holds the first bytes of at most one track, outside the prefetch budget,
+// so a guess never pushes a queued track out. Throttled, and dropped as
+// soon as the cursor moves on.
+class HeadFetcher {
+public:
+    struct Head {
+        std::shared_ptr<const std::vector<char>> data;
+        bool complete = false;          // the whole file fit
+    };
+
+private:
+    size_t head_bytes;
+    curl_off_t max_rate;                // bytes per second, 0 for unthrottled
+    AudioCache* cache;
+    BufferPool* pool;
+    std::string wanted;
+    std::string active_url;
+    std::string head_url;
+    Head head;
+    std::atomic<bool> cancel_active{false};
+    bool exit_requested = false;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::thread worker;
+
+    struct Transfer {
+        HeadFetcher* self;
+        PooledDownload download;
+        bool capped;
+    };
+
+    static size_t write_callback(void* contents, size_t size, size_t nmemb, void* userp) {
+        auto* xfer = static_cast<Transfer*>(userp);
+        size_t room = xfer->self->head_bytes - xfer->download.size();
+        size_t total = size * nmemb;
+        if (total > room) {
+            // Servers that ignore the Range header send the whole file.
+            xfer->download.append(static_cast<char*>(contents), room);
+            xfer->capped = true;
+            return 0;
+        }
+        return xfer->download.append(static_cast<char*>(contents), total);
+    }
+
+    static int progress_callback(void* clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+        return static_cast<HeadFetcher*>(clientp)->cancel_active ? 1 : 0;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (!exit_requested) {
+            if (wanted.empty() || wanted == head_url || cache->contains(wanted)) {
+                cv.wait(lock);
+                continue;
+            }
+            std::string url = wanted;
+            active_url = url;
+            cancel_active = false;
+            Transfer xfer{this, PooledDownload{pool}, false};
+            lock.unlock();
+
+            xfer.download.data = pool->acquire(head_bytes);     // not the full Content-Length of a 200 reply
+            CURLcode res = CURLE_FAILED_INIT;
+            long code = 0;
+            if (auto http = http_client().acquire(); CURL* curl = http.get()) {
+                std::string range = "0-" + std::to_string(head_bytes - 1);
+                xfer.download.curl = curl;
+                curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+                curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+                curl_easy_setopt(curl, CURLOPT_MAX_RECV_SPEED_LARGE, max_rate);
+                curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+                curl_easy_setopt(curl, CURLOPT_WRITEDATA, &xfer);
+                curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+                curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progress_callback);
+                curl_easy_setopt(curl, CURLOPT_XFERINFODATA, this);
+                res = http.perform();
+                curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+            }
+
+            lock.lock();
+            active_url.clear();
+            bool ok = (res == CURLE_OK || xfer.capped) && xfer.download.size() > 0 && code < 300;
+            if (ok && url == wanted) {
+                head_url = url;
+                head.data = std::move(xfer.download.data);
+                // A full 200 reply or a short 206 one means there is nothing after the head.
+                head.complete = !xfer.capped && (code == 200 || head.data->size() < head_bytes);
+            }
+        }
+    }
+
+public:
+    HeadFetcher(size_t bytes, curl_off_t rate, AudioCache* c, BufferPool* p)
+      : head_bytes(std::max<size_t>(bytes, 1)), max_rate(rate), cache(c), pool(p) {
+        worker = std::thread(&HeadFetcher::run, this);
+    }
+
+    ~HeadFetcher() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            exit_requested = true;
+            cancel_active = true;
+        }
+        cv.notify_all();
+        worker.join();
+    }
+
+    // The track to fetch the head of; empty cancels. A finished head is kept
+    // until another one replaces it or it is taken.
+    void want(const std::string& url) {
+        std::lock_guard<std::mutex> lock(mtx);
+        wanted = url;
+        if (!active_url.empty() && active_url != url) cancel_active = true;
+        cv.notify_all();
+    }
+
+    Head take(const std::string& url) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (url != head_url) return {};
+        head_url.clear();
+        if (wanted == url) wanted.clear();
+        Head taken = std::move(head);
+        head = {};
+        return taken;
+    }
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Real-time tuning (opt-in, best effort; refusals are reported, not fatal)
+// ─────────────────────────────────────────────────────────────────────────────
+
+// SCHED_FIFO at `priority`. Without CAP_SYS_NICE the kernel still allows
+// RLIMIT_RTPRIO (what rtkit or limits.conf hand out), so retry capped at that.
+static std::string set_realtime_priority(pthread_t thread, int priority) {
+#if defined(__linux__)
+    sched_param param{};
+    param.sched_priority = std::clamp(priority, sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+    int err = pthread_setschedparam(thread, SCHED_FIFO, &param);
+    rlimit lim{};
+    if (err == EPERM && getrlimit(RLIMIT_RTPRIO, &lim) == 0 && lim.rlim_cur > 0) {
+        param.sched_priority = std::min<int>(param.sched_priority, static_cast<int>(lim.rlim_cur));
+        err = pthread_setschedparam(thread, SCHED_FIFO, &param);
+    }
+    if (err == 0) return "SCHED_FIFO " + std::to_string(param.sched_priority);
+    return std::string("default scheduling (SCHED_FIFO: ") + std::strerror(err) + ")";
+#else
+    (void)thread; (void)priority;
+    return "default scheduling (SCHED_FIFO unsupported)";
+#endif
+}
+
+static std::string pin_thread(pthread_t thread, const std::vector<int>& cpus) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    std::string list;
+    for (int c : cpus) {
+        if (c < 0 || c >= CPU_SETSIZE) continue;
+        CPU_SET(c, &set);
+        list += (list.empty() ? "" : ",") + std::to_string(c);
+    }
+    int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (err == 0) return "cpus " + list;
+    return std::string("unpinned (") + std::strerror(err) + ")";
+#else
+    (void)thread; (void)cpus;
+    return "unpinned (unsupported)";
+#endif
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// DSP chain (runs in the device callback: in place, no allocation, no locks)
+// ─────────────────────────────────────────────────────────────────────────────
+
+class DspStage {
+public:
+    virtual ~DspStage() = default;
+    // Interleaved float frames, processed in place.
+    virtual void process(float* samples, size_t frames, ma_uint32 channels, ma_uint32 rate) = 0;
+};
+
+// Stages are added before the device starts and never change afterwards.
+class DspChain {
+private:
+    std::vector<std::unique_ptr<DspStage>> stages;
+
+public:
+    template <typename Stage>
+    Stage* add(std::unique_ptr<Stage> stage) {
+        Stage* raw = stage.get();
+        stages.push_back(std::move(stage));
+        return raw;
+    }
+
+    void process(float* samples, size_t frames, ma_uint32 channels, ma_uint32 rate) {
+        for (auto& s : stages) s->process(samples, frames, channels, rate);
+    }
+};
+
+// Ramps from the previous block's gain to the current target; a steady gain
+// is a plain multiply and unity skips the pass entirely.
+class VolumeStage : public DspStage {
+private:
+    const std::atomic<float>& target;
+    float applied = 1.0f;
+
+public:
+    explicit VolumeStage(const std::atomic<float>& t) : target(t) {}
+
+    void process(float* samples, size_t frames, ma_uint32 channels, ma_uint32) override {
+        size_t count = frames * channels;
+        float gain = target.load(std::memory_order_relaxed);
+        if (gain != applied) {
+            apply_gain_ramp(samples, count, applied, gain);
+            applied = gain;
+        } else if (gain != 1.0f) {
+            apply_gain(samples, count, gain);
+        }
+    }
+};
+
+struct EqBand {
+    enum Type { PEAK, LOW_SHELF, HIGH_SHELF } type = PEAK;
+    double freq = 1000.0;
+    double q = 0.707;
+    double gain_db = 0.0;
+};
+
+struct EqPreset {
+    std::string name;
+    std::vector<EqBand> bands;      // empty for flat, which bypasses the stage
+};
+
+static std::vector<EqPreset> builtin_eq_presets() {
+    return {
+        {"flat", {}},
+        {"bass", {{EqBand::LOW_SHELF, 110, 0.7, 6}}},
+        {"treble", {{EqBand::HIGH_SHELF, 7000, 0.7, 5}}},
+        {"vocal", {{EqBand::LOW_SHELF, 150, 0.7, -3}, {EqBand::PEAK, 2500, 1.0, 3}, {EqBand::PEAK, 5000, 2.0, 1.5}}},
+        {"loudness", {{EqBand::LOW_SHELF, 80, 0.7, 5}, {EqBand::PEAK, 2500, 0.8, -1.5}, {EqBand::HIGH_SHELF, 10000, 0.7, 4}}},
+    };
+}
+
+// Biquads run as a pipelined cascade: lane b of a 4-lane vector is band b,
+// fed with band b-1's output from the previous sample, so one vector step
+// advances four bands at once. The cost is a fixed delay of 3 samples
+// (EQ_LANES - 1) per group of four bands.
+static constexpr size_t EQ_LANES = 4;
+static constexpr size_t EQ_MAX_GROUPS = 2;
+static constexpr size_t EQ_MAX_BANDS = EQ_LANES * EQ_MAX_GROUPS;
+static constexpr ma_uint32 EQ_MAX_CHANNELS = 8;     // wider layouts bypass the EQ
+static constexpr ma_uint32 EQ_FADE_MS = 5;          // crossfade between the old and new preset
+static constexpr size_t EQ_FADE_CHUNK = 256;        // frames faded per pass over the scratch buffer
+
+// Transposed direct form II, normalised by a0, one lane per band.
+struct EqCoefficients {
+    struct Group {
+        alignas(16) float b0[EQ_LANES], b1[EQ_LANES], b2[EQ_LANES], a1[EQ_LANES], a2[EQ_LANES];
+    };
+    Group groups[EQ_MAX_GROUPS];
+    size_t group_count = 0;
+    ma_uint32 rate = 0;
+};
+
+// |c0 + c1 e^-jw + c2 e^-2jw|: a biquad's numerator or denominator.
+static double quadratic_magnitude(const double* c, double w) {
+    return std::hypot(c[0] + c[1] * std::cos(w) + c[2] * std::cos(2 * w), c[1] * std::sin(w) + c[2] * std::sin(2 * w));
+}
+
+// RBJ audio EQ cookbook. Unused lanes pass the signal through, and the peak
+// of the whole cascade's response is taken off up front so the EQ cannot clip
+// by itself; overlapping boosts add up, so the largest single gain is not enough.
+static std::unique_ptr<EqCoefficients> compile_eq(const EqPreset& preset, ma_uint32 rate) {
+    auto eq = std::make_unique<EqCoefficients>();
+    eq->rate = rate;
+    size_t bands = std::min(preset.bands.size(), EQ_MAX_BANDS);
+    eq->group_count = (bands + EQ_LANES - 1) / EQ_LANES;
+    const double pi = 3.14159265358979323846;
+
+    double coeffs[EQ_MAX_BANDS][6];     // b0, b1, b2, a0, a1, a2
+    for (size_t i = 0; i < bands; ++i) {
+        const EqBand& band = preset.bands[i];
+        double A = std::pow(10.0, band.gain_db / 40.0);
+        double w0 = 2 * pi * std::min(band.freq, 0.45 * rate) / rate;
+        double cw = std::cos(w0), alpha = std::sin(w0) / (2 * std::max(band.q, 0.1));
+        double sa = 2 * std::sqrt(A) * alpha;
+        double* c = coeffs[i];
+        switch (band.type) {
+            case EqBand::PEAK:
+                c[0] = 1 + alpha * A; c[1] = -2 * cw; c[2] = 1 - alpha * A;
+                c[3] = 1 + alpha / A; c[4] = -2 * cw; c[5] = 1 - alpha / A;
+                break;
+            case EqBand::LOW_SHELF:
+                c[0] = A * ((A + 1) - (A - 1) * cw + sa);
+                c[1] = 2 * A * ((A - 1) - (A + 1) * cw);
+                c[2] = A * ((A + 1) - (A - 1) * cw - sa);
+                c[3] = (A + 1) + (A - 1) * cw + sa;
+                c[4] = -2 * ((A - 1) + (A + 1) * cw);
+                c[5] = (A + 1) + (A - 1) * cw - sa;
+                break;
+            case EqBand::HIGH_SHELF:
+                c[0] = A * ((A + 1) + (A - 1) * cw + sa);
+                c[1] = -2 * A * ((A - 1) + (A + 1) * cw);
+                c[2] = A * ((A + 1) + (A - 1) * cw - sa);
+                c[3] = (A + 1) - (A - 1) * cw + sa;
+                c[4] = 2 * ((A - 1) - (A + 1) * cw);
+                c[5] = (A + 1) - (A - 1) * cw - sa;
+                break;
+        }
+    }
+
+    for (size_t i = 0; i < eq->group_count * EQ_LANES; ++i) {
+        double c[6] = {1, 0, 0, 1, 0, 0};
+        if (i < bands) std::copy(coeffs[i], coeffs[i] + 6, c);
+        EqCoefficients::Group& g = eq->groups[i / EQ_LANES];
+        size_t lane = i % EQ_LANES;
+        g.b0[lane] = float(c[0] / c[3]); g.b1[lane] = float(c[1] / c[3]); g.b2[lane] = float(c[2] / c[3]);
+        g.a1[lane] = float(c[4] / c[3]); g.a2[lane] = float(c[5] / c[3]);
+        // What actually runs: a shelf far below Nyquist has its poles close
+        // enough to 1 that rounding to float moves its gain measurably.
+        const double rounded[6] = {g.b0[lane], g.b1[lane], g.b2[lane], 1.0, g.a1[lane], g.a2[lane]};
+        std::copy(rounded, rounded + 6, coeffs[i]);
+    }
+
+    // Sampled at DC and on a log grid from 1 Hz to Nyquist, with the highest
+    // grid point then narrowed down between its neighbours.
+    auto response = [&](double w) {
+        double m = 1.0;
+        for (size_t i = 0; i < bands; ++i) m *= quadratic_magnitude(coeffs[i], w) / quadratic_magnitude(coeffs[i] + 3, w);
+        return m;
+    };
+    auto grid_w = [&](double k) { return 2 * pi * std::min(std::pow(0.5 * rate, k), 0.5 * rate) / rate; };
+    double peak = response(0.0), peak_w = 0.0;
+    auto consider = [&](double w) {
+        double m = response(w);
+        if (m > peak) { peak = m; peak_w = w; }
+        return m;
+    };
+    if (bands) {
+        const int grid = 1024;
+        int best = 0;
+        double best_m = 0.0;
+        for (int k = 0; k <= grid; ++k) {
+            double m = consider(grid_w(double(k) / grid));
+            if (m > best_m) { best_m = m; best = k; }
+        }
+        double lo = double(std::max(best - 1, 0)) / grid, hi = double(std::min(best + 1, grid)) / grid;
+        for (int it = 0; it < 40; ++it) {
+            double m1 = lo + (hi - lo) / 3, m2 = hi - (hi - lo) / 3;
+            if (consider(grid_w(m1)) < consider(grid_w(m2))) lo = m1; else hi = m2;
+        }
+    }
+    if (peak <= 1.0) return eq;
+
+    // The preamp goes on the lane whose numerator cancels least at the peak,
+    // a spare lane if there is one, so rounding the scaled coefficients
+    // does not move the gain there.
+    size_t target = 0;
+    double best_ratio = -1.0;
+    for (size_t i = 0; i < eq->group_count * EQ_LANES; ++i) {
+        const double* c = coeffs[i];
+        double ratio = quadratic_magnitude(c, peak_w) / (std::fabs(c[0]) + std::fabs(c[1]) + std::fabs(c[2]));
+        if (ratio > best_ratio) { best_ratio = ratio; target = i; }
+    }
+    EqCoefficients::Group& g = eq->groups[target / EQ_LANES];
+    size_t lane = target % EQ_LANES;
+    g.b0[lane] = float(g.b0[lane] / peak); g.b1[lane] = float(g.b1[lane] / peak); g.b2[lane] = float(g.b2[lane] / peak);
+    return eq;
+}
+
+// Four lanes of floats: SSE where available, a plain array otherwise.
+#if defined(__SSE2__)
+struct EqVec {
+    __m128 v;
+    static EqVec load(const float* p) { return {_mm_load_ps(p)}; }
+    static EqVec zero() { return {_mm_setzero_ps()}; }
+    friend EqVec operator+(EqVec a, EqVec b) { return {_mm_add_ps(a.v, b.v)}; }
+    friend EqVec operator-(EqVec a, EqVec b) { return {_mm_sub_ps(a.v, b.v)}; }
+    friend EqVec operator*(EqVec a, EqVec b) { return {_mm_mul_ps(a.v, b.v)}; }
+    // {x, v0, v1, v2}: each band takes the previous band's last output.
+    EqVec shift_in(float x) const {
+        return {_mm_move_ss(_mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 4)), _mm_set_ss(x))};
+    }
+    float last() const { return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))); }
+};
+#else
+struct EqVec {
+    float v[EQ_LANES];
+    static EqVec load(const float* p) { EqVec r; std::copy(p, p + EQ_LANES, r.v); return r; }
+    static EqVec zero() { return EqVec{}; }
+    friend EqVec operator+(EqVec a, EqVec b) { for (size_t i = 0; i < EQ_LANES; ++i) a.v[i] += b.v[i]; return a; }
+    friend EqVec operator-(EqVec a, EqVec b) { for (size_t i = 0; i < EQ_LANES; ++i) a.v[i] -= b.v[i]; return a; }
+    friend EqVec operator*(EqVec a, EqVec b) { for (size_t i = 0; i < EQ_LANES; ++i) a.v[i] *= b.v[i]; return a; }
+    EqVec shift_in(float x) const { return {{x, v[0], v[1], v[2]}}; }
+    float last() const { return v[EQ_LANES - 1]; }
+};
+#endif
+
+class EqStage : public DspStage {
+private:
+    std::atomic<const EqCoefficients*> coefficients{nullptr};
+
+    // Filter state per group and channel.
+    struct State {
+        EqVec s1, s2, y;
+    };
+    using States = State[EQ_MAX_GROUPS][EQ_MAX_CHANNELS];
+
+    // A new set starts from zeroed state and is faded in over the output of
+    // the old one, which keeps running on its own state meanwhile. Besides
+    // the state jump this hides the few samples of delay the lane pipeline
+    // adds, which a switch to or from flat would otherwise turn into a click.
+    // Null stands for flat.
+    const EqCoefficients* active = nullptr;
+    const EqCoefficients* fading = nullptr;
+    States state, fade_state;
+    size_t fade_left = 0, fade_frames = 0;
+    ma_uint32 state_rate = 0, state_channels = 0;
+    float scratch[EQ_FADE_CHUNK * EQ_MAX_CHANNELS];
+
+    static void clear(States& st) {
+        for (auto& group : st) for (auto& s : group) s = {EqVec::zero(), EqVec::zero(), EqVec::zero()};
+    }
+
+    // Channels == 0 takes the count at run time; fixed counts let the
+    // compiler unroll the channel loop.
+    template <ma_uint32 Channels>
+    static void run(const EqCoefficients& eq, States& state, float* samples, size_t frames, ma_uint32 channels) {
+        const ma_uint32 nch = Channels ? Channels : channels;
+        for (size_t g = 0; g < eq.group_count; ++g) {
+            const EqCoefficients::Group& c = eq.groups[g];
+            const EqVec b0 = EqVec::load(c.b0), b1 = EqVec::load(c.b1), b2 = EqVec::load(c.b2);
+            const EqVec a1 = EqVec::load(c.a1), a2 = EqVec::load(c.a2);
+            for (ma_uint32 ch = 0; ch < nch; ++ch) {
+                State st = state[g][ch];
+                float* p = samples + ch;
+                for (size_t f = 0; f < frames; ++f, p += nch) {
+                    EqVec x = st.y.shift_in(*p);
+                    st.y = b0 * x + st.s1;
+                    st.s1 = b1 * x - a1 * st.y + st.s2;
+                    st.s2 = b2 * x - a2 * st.y;
+                    *p = st.y.last();
+                }
+                state[g][ch] = st;
+            }
+        }
+    }
+
+#if defined(__AVX2__)
+    // Both channels in one 256-bit vector: lanes 0-3 left, 4-7 right.
+    static void run_stereo_avx(const EqCoefficients& eq, States& state, float* samples, size_t frames) {
+        for (size_t g = 0; g < eq.group_count; ++g) {
+            const EqCoefficients::Group& c = eq.groups[g];
+            auto both = [](const float* p) { __m128 h = _mm_load_ps(p); return _mm256_set_m128(h, h); };
+            const __m256 b0 = both(c.b0), b1 = both(c.b1), b2 = both(c.b2), a1 = both(c.a1), a2 = both(c.a2);
+            __m256 s1 = _mm256_set_m128(state[g][1].s1.v, state[g][0].s1.v);
+            __m256 s2 = _mm256_set_m128(state[g][1].s2.v, state[g][0].s2.v);
+            __m256 y = _mm256_set_m128(state[g][1].y.v, state[g][0].y.v);
+            float* p = samples;
+            for (size_t f = 0; f < frames; ++f, p += 2) {
+                __m256 shifted = _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(y), 4));
+                __m256 x = _mm256_blend_ps(shifted, _mm256_setr_ps(p[0], 0, 0, 0, p[1], 0, 0, 0), 0x11);
+                y = _mm256_add_ps(_mm256_mul_ps(b0, x), s1);
+                s1 = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(b1, x), _mm256_mul_ps(a1, y)), s2);
+                s2 = _mm256_sub_ps(_mm256_mul_ps(b2, x), _mm256_mul_ps(a2, y));
+                __m256 out = _mm256_permute_ps(y, _MM_SHUFFLE(3, 3, 3, 3));
+                p[0] = _mm256_cvtss_f32(out);
+                p[1] = _mm_cvtss_f32(_mm256_extractf128_ps(out, 1));
+            }
+            state[g][0] = {{_mm256_castps256_ps128(s1)}, {_mm256_castps256_ps128(s2)}, {_mm256_castps256_ps128(y)}};
+            state[g][1] = {{_mm256_extractf128_ps(s1, 1)}, {_mm256_extractf128_ps(s2, 1)}, {_mm256_extractf128_ps(y, 1)}};
+        }
+    }
+#endif
+
+    static void filter(const EqCoefficients& eq, States& state, float* samples, size_t frames, ma_uint32 channels) {
+        switch (channels) {
+            case 1: run<1>(eq, state, samples, frames, channels); break;
+#if defined(__AVX2__)
+            case 2: run_stereo_avx(eq, state, samples, frames); break;
+#else
+            case 2: run<2>(eq, state, samples, frames, channels); break;
+#endif
+            default: run<0>(eq, state, samples, frames, channels); break;
+        }
+    }
+
+public:
+    EqStage() {
+        clear(state);
+        clear(fade_state);
+    }
+
+    // Takes effect on the next block. The caller keeps every set it has
+    // published alive for as long as the stage exists.
+    void publish(const EqCoefficients* eq) {
+        coefficients.store(eq, std::memory_order_release);
+    }
+
+    void process(float* samples, size_t frames, ma_uint32 channels, ma_uint32 rate) override {
+        if (channels > EQ_MAX_CHANNELS) return;
+        const EqCoefficients* eq = coefficients.load(std::memory_order_acquire);
+        if (eq && (!eq->group_count || eq->rate != rate)) eq = nullptr;
+        if (rate != state_rate || channels != state_channels) {
+            // A new device: there is no old output to fade from.
+            clear(state);
+            active = eq;
+            fade_left = 0;
+            state_rate = rate;
+            state_channels = channels;
+        } else if (eq != active) {
+            fading = active;
+            std::copy(&state[0][0], &state[0][0] + EQ_MAX_GROUPS * EQ_MAX_CHANNELS, &fade_state[0][0]);
+            clear(state);
+            active = eq;
+            fade_frames = fade_left = std::max<size_t>(size_t(rate) * EQ_FADE_MS / 1000, 1);
+        }
+
+        size_t done = 0;
+        while (fade_left && done < frames) {
+            size_t n = std::min({frames - done, fade_left, EQ_FADE_CHUNK});
+            float* p = samples + done * channels;
+            std::copy(p, p + n * channels, scratch);
+            if (fading) filter(*fading, fade_state, scratch, n, channels);
+            if (active) filter(*active, state, p, n, channels);
+            for (size_t f = 0; f < n; ++f) {
+                float old_weight = float(fade_left - f) / float(fade_frames);
+                for (ma_uint32 ch = 0; ch < channels; ++ch) {
+                    size_t i = f * channels + ch;
+                    p[i] += (scratch[i] - p[i]) * old_weight;
+                }
+            }
+            fade_left -= n;
+            done += n;
+        }
+        if (active && done < frames) filter(*active, state, samples + done * channels, frames - done, channels);
+    }
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Audio diagnostics (updated with relaxed atomics, including from the callback)
+// ─────────────────────────────────────────────────────────────────────────────
+
+// Bucket i counts durations in [2^i, 2^(i+1)) nanoseconds.
+class Log2Histogram {
+public:
+    static constexpr int BUCKETS = 32;
+
+    void record(uint64_t ns) {
+        int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+        buckets[std::min(bucket, BUCKETS - 1)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    struct Snapshot {
+        std::array<uint64_t, BUCKETS> counts{};
+        uint64_t total = 0;
+
+        // Upper edge of the bucket holding quantile q, so an overestimate of
+        // at most 2x.
+        double quantile_us(double q) const {
+            uint64_t rank = static_cast<uint64_t>(std::ceil(q * total));
+            uint64_t seen = 0;
+            for (int i = 0; i < BUCKETS; ++i) {
+                seen += counts[i];
+                if (seen && seen >= rank) return std::ldexp(1.0, i + 1) / 1000.0;
+            }
+            return 0.0;
+        }
+    };
+
+    Snapshot snapshot() const {
+        Snapshot snap;
+        for (int i = 0; i < BUCKETS; ++i) {
+            snap.counts[i] = buckets[i].load(std::memory_order_relaxed);
+            snap.total += snap.counts[i];
+        }
+        return snap;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+};
+
+// miniaudio recovers from ALSA/Pulse xruns internally without telling the
+// application, so they are inferred from gaps between callbacks.
+struct AudioDiagnostics {
+    std::atomic<uint64_t> callbacks{0};
+    std::atomic<uint64_t> max_callback_ns{0};   // written by the callback only
+    std::atomic<uint64_t> underruns{0};         // blocks the ring could not fill while playing
+    std::atomic<uint64_t> underrun_frames{0};
+    std::atomic<uint64_t> late_callbacks{0};    // more than two periods since the previous block
+    std::atomic<uint64_t> device_events{0};     // interruptions and reroutes
+    std::atomic<uint64_t> period_ns{0};         // smoothed interval between callbacks
+    Log2Histogram callback_time;
+    Log2Histogram lock_wait_time;               // contended acquisitions of decoder_mutex
+    Log2Histogram dsp_time;                     // the DSP chain's share of each callback
+
+    std::vector<std::string> report() const {
+        auto line = [](const char* fmt, auto... args) {
+            char buf[128];
+            snprintf(buf, sizeof(buf), fmt, args...);
+            return std::string(buf);
+        };
+        Log2Histogram::Snapshot cb = callback_time.snapshot(), lw = lock_wait_time.snapshot(), dsp = dsp_time.snapshot();
+        auto load = [](const std::atomic<uint64_t>& v) { return (unsigned long long)v.load(std::memory_order_relaxed); };
+        return {
+            line("Callbacks: %llu, max %.0f us", load(callbacks), max_callback_ns.load(std::memory_order_relaxed) / 1000.0),
+            line("  p50 <%.0f us, p99 <%.0f us", cb.quantile_us(0.5), cb.quantile_us(0.99)),
+            line("DSP: p50 <%.0f us, p99 <%.0f us", dsp.quantile_us(0.5), dsp.quantile_us(0.99)),
+            line("Underruns: %llu (%llu frames)", load(underruns), load(underrun_frames)),
+            line("Late callbacks: %llu", load(late_callbacks)),
+            line("Device events: %llu", load(device_events)),
+            line("Lock waits: %llu, p99 <%.0f us", (unsigned long long)lw.total, lw.quantile_us(0.99)),
+        };
+    }
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Audio playback system
+// ─────────────────────────────────────────────────────────────────────────────
+
+struct PlayerEvent {
+    enum Type { STARTED, ADVANCED, FAILED } type;
+    std::string url;
+};
+
+// Device buffering presets. Small periods make pause and volume respond
+// sooner; large ones wake the CPU less often.
+struct LatencyProfile {
+    const char* name;
+    ma_uint32 period_ms;
+    ma_uint32 periods;
+    ma_performance_profile performance;
+};
+
+static const LatencyProfile LATENCY_PROFILES[] = {
+    {"low-latency",   5, 3, ma_performance_profile_low_latency},
+    {"balanced",     20, 3, ma_performance_profile_low_latency},
+    {"power-saver", 100, 4, ma_performance_profile_conservative},
+};
+static constexpr size_t LATENCY_PROFILE_COUNT = sizeof(LATENCY_PROFILES) / sizeof(LATENCY_PROFILES[0]);
+static constexpr size_t DEFAULT_LATENCY_PROFILE = 1;
+
+static size_t latency_profile_index(const std::string& name) {
+    for (size_t i = 0; i < LATENCY_PROFILE_COUNT; ++i) {
+        if (name == LATENCY_PROFILES[i].name) return i;
+    }
+    return DEFAULT_LATENCY_PROFILE;
+}
+
+struct PlayerSettings {
+    bool   streaming           = true;              // start playback before the download completes
+    size_t stream_start_bytes  = 128 * 1024;        // bytes needed before the decoder is opened
+    size_t stream_start_frames = 22050;             // frames decoded before the device starts
+    size_t stream_buffer_bytes = 8 * 1024 * 1024;   // bounded download window
+    size_t prefetch_count      = 2;                 // upcoming tracks downloaded ahead of time
+    size_t prefetch_max_bytes  = 64 * 1024 * 1024;  // memory cap for prefetched tracks
+    bool   passthrough         = true;              // open the device at each track's native rate/channels
+    double crossfade_seconds   = 0.0;               // overlap between queued tracks, 0 for gapless
+    bool   normalize           = true;              // apply measured loudness gain (needs the cache)
+    double normalize_target_lufs = -18.0;
+    unsigned loudness_threads  = 2;                 // idle-priority analysis workers
+    int    rt_priority         = 0;                 // SCHED_FIFO priority for audio threads, 0 = off
+    std::vector<int> cpu_affinity;                  // CPUs for the decode and callback threads, empty = any
+    bool   lock_memory         = false;             // mlock the PCM ring and decoder state
+    std::string latency_profile = LATENCY_PROFILES[DEFAULT_LATENCY_PROFILE].name;
+    unsigned speculative_delay_ms = 600;            // cursor rest before fetching a track's head, 0 = off
+    size_t speculative_bytes   = 384 * 1024;
+    size_t speculative_max_rate = 1024 * 1024;      // bytes per second
+    std::vector<EqPreset> eq_presets = builtin_eq_presets();
+    std::string eq_preset      = "flat";
+    std::string cache_dir      = "aitunes_cache";
+    uint64_t cache_max_bytes   = 1024ULL * 1024 * 1024; // 0 disables the on-disk cache
+};
+
+class AudioPlayer {
+private:
+    static constexpr ma_uint32 DECODE_CHUNK_FRAMES = 4096;
+    static constexpr ma_uint32 XFADE_SEGMENT_FRAMES = 256;     // the fade curve is linear within a segment
+    static constexpr ma_uint32 RING_SECONDS        = 2;
+    static constexpr ma_uint32 DEFAULT_CHANNELS    = 2;
+    static constexpr ma_uint32 DEFAULT_SAMPLE_RATE = 44100;
+    static constexpr unsigned STREAM_RETRIES       = 6;        // consecutive failed attempts before a stream gives up
+    static constexpr unsigned RETRY_BASE_MS        = 250;      // doubled per failed attempt
+    static constexpr unsigned RETRY_MAX_MS         = 8000;
+
+    // One opened track: the decoder and the bytes it reads from.
+    struct TrackSlot {
+        std::string url;
+        ma_decoder decoder;
+        bool decoder_ready = false;
+        std::shared_ptr<const std::vector<char>> data;  // whole-file or prefetched download
+        std::shared_ptr<MappedFile> mapped;             // on-disk cache hit
+        float gain = 1.0f;                              // loudness normalization
+        std::shared_ptr<StreamBuffer> stream;   // progressive download
+        std::thread download;                   // feeds stream, or writes data to the cache
+        uint64_t frame_offset = 0;              // track frame the stream starts at (a restarted transcode)
+
+        // Length in output frames, 0 while unknown; filled in by the indexer
+        // for MP3s held in memory.
+        std::shared_ptr<std::atomic<uint64_t>> length_frames = std::make_shared<std::atomic<uint64_t>>(0);
+        std::thread indexer;
+        std::vector<drmp3_seek_point> seek_points;  // written by indexer before index_ready
+        std::atomic<bool> index_ready{false};
+        bool index_bound = false;                   // decode thread only
+        std::vector<std::pair<const void*, size_t>> locked_ranges;     // see lock_memory()
+
+        ~TrackSlot() {
+            if (stream) stream->cancel();
+            if (download.joinable()) download.join();
+            if (indexer.joinable()) indexer.join();
+            unlock_memory();
+            if (decoder_ready) ma_decoder_uninit(&decoder);
+        }
+
+        // Keeps the decoder state resident: this struct and whichever backend
+        // decodes. The compressed input is not locked since the ring covers a
+        // fault while reading it.
+        void lock_memory() {
+            lock_range(this, sizeof(*this));
+            if (!decoder_ready || locked_ranges.empty()) return;
+            if (is_mp3()) {
+                lock_range(decoder.pBackend, sizeof(Mp3Backend));
+            } else if (decoder.pBackendVTable == &g_ma_decoding_backend_vtable_wav) {
+                lock_range(decoder.pBackend, sizeof(ma_wav));
+            } else if (decoder.pBackendVTable == &g_ma_decoding_backend_vtable_flac) {
+                auto* flac = static_cast<ma_flac*>(decoder.pBackend);
+                lock_range(flac, sizeof(ma_flac));
+                // One allocation: the decoder, then a SIMD-aligned block of
+                // decoded samples for every channel.
+                ma_dr_flac* dr = flac->dr;
+                const size_t vec = MA_DR_FLAC_MAX_SIMD_VECTOR_SIZE / sizeof(ma_int32);
+                size_t per_channel = (dr->maxBlockSizeInPCMFrames + vec - 1) / vec * vec;
+                const char* end = reinterpret_cast<const char*>(dr->pDecodedSamples + per_channel * dr->channels);
+                lock_range(dr, static_cast<size_t>(end - reinterpret_cast<const char*>(dr)));
+            }
+        }
+
+        void unlock_memory() {
+            for (auto& r : locked_ranges) unlock_pages(r.first, r.second);
+            locked_ranges.clear();
+        }
+
+        void lock_range(const void* addr, size_t len) {
+            if (lock_pages(addr, len)) locked_ranges.emplace_back(addr, len);
+        }
+
+        bool is_mp3() const {
+            return decoder_ready && decoder.pBackendVTable == &g_mp3_backend_vtable;
+        }
+
+        bool fully_downloaded() const {
+            return !stream || stream->is_complete();
+        }
+
+        bool same_format(const ma_device& dev) const {
+            return decoder.outputChannels == dev.playback.channels && decoder.outputSampleRate == dev.sampleRate;
+        }
+    };
+
+    // Ring position at which a spliced-in track becomes audible.
+    struct TrackBoundary {
+        uint64_t sample_pos;
+        std::string url;
+        std::shared_ptr<std::atomic<uint64_t>> length_frames;
+    };
+
+    struct LoadToken {
+        const std::atomic<uint64_t>* generation;
+        uint64_t expected;
+        const std::atomic<uint64_t>* queue_generation = nullptr;   // prerolls also die when the queue head changes
+        uint64_t queue_expected = 0;
+        bool stale() const {
+            return generation->load() != expected
+                || (queue_generation && queue_generation->load() != queue_expected);
+        }
+    };
+
+    ma_context context;
+    bool context_ready = false;
+    ma_device device;
+    bool device_open = false;
+    pthread_t callback_thread{};                // written by the callback before callback_seen
+    std::atomic<bool> callback_seen{false};     // reset per device: its callback thread is new
+    bool callback_pinned = false;               // decoder_mutex
+    std::string rt_report;
+    std::atomic<ma_uint32> output_channels{0};  // mirrors of the device format for the UI
+    std::atomic<ma_uint32> output_rate{0};
+    AudioDiagnostics diagnostics;
+    std::atomic<size_t> latency_profile{DEFAULT_LATENCY_PROFILE};
+    std::atomic<ma_uint32> device_periods{0};   // what the backend granted, which may differ from the profile
+    std::atomic<uint64_t> device_buffer_us{0};
+    uint64_t last_callback_ns = 0;              // device thread only
+    std::atomic<bool> callback_resync{true};    // device (re)started, so the next gap is not a late block
+    std::atomic<bool> output_suspended{false};  // device stopped by suspend_output()
+    std::atomic<bool> decoder_eof{false};
+    std::atomic<bool> is_playing{false};
+    std::atomic<bool> is_paused{false};
+    std::atomic<float> volume{1.0f};           // target gain, set from the UI
+    DspChain dsp;                               // applied to every block the callback hands out
+    EqStage* eq = nullptr;                      // owned by dsp
+    std::mutex eq_mutex;                        // guards eq_compiled and eq_rate; publishes happen under it
+    std::map<std::pair<size_t, ma_uint32>, std::unique_ptr<EqCoefficients>> eq_compiled;    // (preset, rate)
+    std::atomic<size_t> eq_index{0};            // written under eq_mutex once the player runs
+    ma_uint32 eq_rate = 0;                      // device rate the published set was compiled for
+    std::atomic<bool> should_stop{false};
+    PlayerSettings settings;
+    PcmRing ring;
+    BufferPool buffers;
+    AudioCache cache;
+    std::unique_ptr<LoudnessAnalyzer> loudness;    // reads only from the cache, so it outlives prefetcher
+    Prefetcher prefetcher;
+    HeadFetcher heads;
+
+    // Decoder state, guarded by decoder_mutex and driven by decode_thread.
+    // Decoder reads can wait on the network, so the decode thread makes them
+    // with the lock released and decoder_busy set; see wait_decoder_idle().
+    std::thread decode_thread;
+    std::mutex decoder_mutex;
+    std::condition_variable idle_cv;            // decoder_busy cleared, or decoder_holds dropped
+    bool decoder_busy = false;                  // reading current/fading outside the lock
+    unsigned decoder_holds = 0;                 // threads in wait_decoder_idle()
+    std::unique_ptr<TrackSlot> current;         // being decoded into the ring
+    std::unique_ptr<TrackSlot> next;            // pre-rolled successor, spliced in at EOF
+    std::unique_ptr<TrackSlot> fading;          // outgoing track while crossfading into current
+    uint64_t fade_total = 0;                    // overlap length in frames
+    uint64_t fade_done = 0;
+    bool current_done = false;                  // current hit EOF and is waiting for next
+    bool format_switch = false;                 // next needs the device re-opened; the loader drains and swaps
+    std::atomic<bool> draining{false};          // mirror of format_switch, so the emptied ring is not an underrun
+    int64_t seek_frame = -1;                    // pending seek in current, applied by the decode thread
+    std::atomic<size_t> flush_to{0};            // ring position the callback skips to after a seek
+
+    // Load requests and the upcoming queue are handled by load_thread;
+    // everything below is guarded by state_mutex. Lock order is
+    // decoder_mutex before state_mutex.
+    mutable std::mutex state_mutex;
+    std::condition_variable load_cv;
+    std::thread load_thread;
+    std::string requested_url;
+    bool request_pending = false;
+    bool loader_exit = false;
+    size_t requested_profile = DEFAULT_LATENCY_PROFILE;
+    bool profile_pending = false;
+    std::atomic<size_t> prebuffer_target{0};        // ring samples wait_for_prebuffer() holds out for
+    std::string reopen_url;                         // transcode to restart at reopen_frame
+    int64_t reopen_frame = -1;
+    std::condition_variable decoder_cv;             // wakes the decode thread, see wake_decoder()
+    bool decoder_wake = false;
+    double seek_target = -1;                        // seconds, from seek_to(); resolved by the decode thread
+    enum OutputRequest { OUTPUT_UNCHANGED, OUTPUT_START, OUTPUT_STOP } output_request = OUTPUT_UNCHANGED;
+    std::shared_ptr<StreamBuffer> pending_stream;   // stream being opened by the loader
+    std::shared_ptr<StreamBuffer> stream;           // stream of the track being decoded
+    std::vector<std::string> upcoming;              // tracks to splice in after the current one
+    std::deque<TrackBoundary> boundaries;
+    std::string decoding_url;                       // mirror of current->url
+    std::string next_url;                           // mirror of next->url
+    std::deque<PlayerEvent> events;
+    std::string current_url;                        // the track that is audible
+    uint64_t audible_start_sample = 0;              // ring position of audible_start_frame
+    uint64_t audible_start_frame = 0;
+    std::shared_ptr<std::atomic<uint64_t>> audible_length;
+    std::atomic<uint64_t> load_generation{0};
+    std::atomic<uint64_t> queue_generation{0};
+    std::atomic<bool> loading{false};
+    
+    static uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static void data_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount) {
+        uint64_t begin = now_ns();
+        AudioPlayer* player = static_cast<AudioPlayer*>(pDevice->pUserData);
+        if (!player->callback_seen.load(std::memory_order_relaxed)) {
+            // The decode thread pins it; no syscalls here.
+            player->callback_thread = pthread_self();
+            player->callback_seen.store(true, std::memory_order_release);
+        }
+        player->fill_buffer(pOutput, frameCount);
+        player->record_callback(begin, now_ns() - begin, frameCount);
+    }
+
+    static void notification_callback(const ma_device_notification* notification) {
+        if (notification->type == ma_device_notification_type_interruption_began
+            || notification->type == ma_device_notification_type_rerouted) {
+            auto* player = static_cast<AudioPlayer*>(notification->pDevice->pUserData);
+            player->diagnostics.device_events.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void record_callback(uint64_t begin, uint64_t duration, ma_uint32 frameCount) {
+        diagnostics.callbacks.fetch_add(1, std::memory_order_relaxed);
+        diagnostics.callback_time.record(duration);
+        if (duration > diagnostics.max_callback_ns.load(std::memory_order_relaxed)) {
+            diagnostics.max_callback_ns.store(duration, std::memory_order_relaxed);
+        }
+        uint64_t period = uint64_t(frameCount) * 1000000000ULL / device.sampleRate;
+        if (callback_resync.load(std::memory_order_relaxed)) {
+            callback_resync.store(false, std::memory_order_relaxed);
+        } else {
+            uint64_t gap = begin - last_callback_ns;
+            if (gap > 2 * period) diagnostics.late_callbacks.fetch_add(1, std::memory_order_relaxed);
+            uint64_t avg = diagnostics.period_ns.load(std::memory_order_relaxed);
+            diagnostics.period_ns.store(avg ? avg - avg / 16 + gap / 16 : gap, std::memory_order_relaxed);
+        }
+        last_callback_ns = begin;
+    }
+    
+    // Real-time: only copies out of the ring, never locks, allocates or decodes.
+    void fill_buffer(void* pOutput, ma_uint32 frameCount) {
+        ma_uint32 channels = device.playback.channels;
+        float* samples = static_cast<float*>(pOutput);
+        size_t wanted = static_cast<size_t>(frameCount) * channels;
+
+        size_t flush = flush_to.exchange(0, std::memory_order_acq_rel);
+        if (flush) ring.skip_to(flush);
+
+        if (!is_playing || is_paused) {
+            memset(pOutput, 0, wanted * sizeof(float));
+            return;
+        }
+        
+        bool eof = decoder_eof.load(std::memory_order_acquire);
+        size_t got = ring.read(samples, wanted);
+        
+        if (got < wanted) {
+            // End of the queue once the decoder is done and the ring is drained,
+            // otherwise the decode thread fell behind and we emit silence.
+            if (eof) {
+                is_playing = false;
+            } else if (!draining.load(std::memory_order_relaxed)) {
+                diagnostics.underruns.fetch_add(1, std::memory_order_relaxed);
+                diagnostics.underrun_frames.fetch_add((wanted - got) / channels, std::memory_order_relaxed);
+            }
+            memset(samples + got, 0, (wanted - got) * sizeof(float));
+        }
+        
+        uint64_t dsp_start = now_ns();
+        dsp.process(samples, frameCount, channels, device.sampleRate);
+        diagnostics.dsp_time.record(now_ns() - dsp_start);
+    }
+
+    void decode_loop() {
+        std::vector<float> scratch, fade_scratch;
+
+        std::unique_lock<std::mutex> lock(decoder_mutex);
+        while (!should_stop) {
+            if (decoder_holds) {
+                // Someone is waiting to swap slots; stay parked until they have.
+                idle_cv.wait(lock, [&]{ return !decoder_holds; });
+                continue;
+            }
+            take_requests();
+            if (seek_frame >= 0 && current) {
+                apply_seek(lock);
+                continue;
+            }
+            if (current_done) {
+                // The loader wakes us once the successor is open.
+                if (!splice_next(lock)) decoder_sleep(lock);
+                continue;
+            }
+            if (!current || decoder_eof || is_paused) {
+                decoder_sleep(lock);
+                continue;
+            }
+            const ma_uint32 channels = current->decoder.outputChannels;
+            const size_t chunk = static_cast<size_t>(DECODE_CHUNK_FRAMES) * channels;
+            if (scratch.size() < chunk) {
+                scratch.resize(chunk);
+                fade_scratch.resize(chunk);
+            }
+            if (ring.writable() < chunk) {
+                release_prebuffer(true);
+                // The callback cannot signal us without risking a syscall, so poll
+                // at a fraction of the ring length while it drains.
+                decoder_sleep(lock, std::chrono::milliseconds(10));
+                continue;
+            }
+
+            if (!fading) maybe_start_crossfade();
+            bool current_ended = false, fade_ended = false;
+            outside_lock(lock, [&] {
+                if (fading) {
+                    fade_ended = decode_crossfade(scratch.data(), fade_scratch.data(), channels, current_ended);
+                    return;
+                }
+                ma_uint64 framesRead = 0;
+                ma_decoder_read_pcm_frames(&current->decoder, scratch.data(), DECODE_CHUNK_FRAMES, &framesRead);
+                if (current->gain != 1.0f) apply_gain(scratch.data(), static_cast<size_t>(framesRead) * channels, current->gain);
+                ring.write(scratch.data(), static_cast<size_t>(framesRead) * channels);
+                current_ended = framesRead < DECODE_CHUNK_FRAMES;
+            });
+            if (current_ended) current_done = true;
+            release_prebuffer(current_done);
+            if (fading && (fade_ended || current_done)) {
+                // Tearing down the old decoder may join its download thread.
+                std::unique_ptr<TrackSlot> finished = std::move(fading);
+                lock.unlock();
+                finished.reset();
+                lock.lock();
+            }
+        }
+    }
+
+    // Decode thread: sleeps with decoder_mutex released until wake_decoder()
+    // or, if given, the timeout.
+    void decoder_sleep(std::unique_lock<std::mutex>& lock, std::chrono::milliseconds timeout = {}) {
+        lock.unlock();
+        {
+            std::unique_lock<std::mutex> slock(state_mutex);
+            if (timeout.count()) decoder_cv.wait_for(slock, timeout, [&]{ return decoder_wake; });
+            else decoder_cv.wait(slock, [&]{ return decoder_wake; });
+            decoder_wake = false;
+        }
+        lock.lock();
+    }
+
+    // The flag stays set until the decode thread has looked again, so a wake
+    // is never lost, whichever lock the change it announces was made under.
+    // Caller must not hold state_mutex.
+    void wake_decoder() {
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            decoder_wake = true;
+        }
+        decoder_cv.notify_all();
+    }
+
+    // Applies what seek_to(), resume() and suspend_output() left under
+    // state_mutex, and pins a new device thread. Decode thread, decoder_mutex
+    // held.
+    void take_requests() {
+        // The device thread only exists once the device runs, and it is
+        // replaced along with the device, which needs decoder_mutex.
+        if (!callback_pinned && callback_seen.load(std::memory_order_acquire)) {
+            callback_pinned = true;
+            if (!settings.cpu_affinity.empty()) pin_thread(callback_thread, settings.cpu_affinity);
+        }
+        double target;
+        OutputRequest output;
+        {
+            std::lock_guard<std::mutex> slock(state_mutex);
+            target = seek_target;
+            output = output_request;
+            seek_target = -1;
+            output_request = OUTPUT_UNCHANGED;
+        }
+        if (output == OUTPUT_START && output_suspended && device_open && is_playing) {
+            start_device();
+        } else if (output == OUTPUT_STOP && !output_suspended && device_open && !loading && !(is_playing && !is_paused)) {
+            ma_device_stop(&device);
+            output_suspended = true;
+        }
+        if (target >= 0 && current) resolve_seek(target);
+    }
+
+    // Turns a requested position into a decoder seek, or hands it to the
+    // loader when a transcode has to be restarted there.
+    void resolve_seek(double seconds) {
+        {
+            std::lock_guard<std::mutex> slock(state_mutex);
+            settle_boundaries();
+            if (!is_playing || loading || current_url != decoding_url || !boundaries.empty()) return;
+        }
+        ma_uint64 frame = static_cast<ma_uint64>(seconds * current->decoder.outputSampleRate);
+        uint64_t length = current->length_frames->load();
+        if (length && frame > length) frame = length;
+        if (needs_reopen(frame)) {
+            {
+                std::lock_guard<std::mutex> slock(state_mutex);
+                reopen_url = current->url;
+                reopen_frame = static_cast<int64_t>(frame);
+            }
+            load_cv.notify_all();
+            return;
+        }
+        seek_frame = static_cast<int64_t>(frame);
+    }
+
+    // Runs `read` on the decode thread with decoder_mutex released. The slots
+    // and the ring stay put meanwhile: whoever would change them waits in
+    // wait_decoder_idle() first.
+    template <typename Read>
+    void outside_lock(std::unique_lock<std::mutex>& lock, Read&& read) {
+        decoder_busy = true;
+        lock.unlock();
+        read();
+        lock.lock();
+        decoder_busy = false;
+        if (decoder_holds) idle_cv.notify_all();
+    }
+
+    // For threads other than the decode thread, with `lock` on decoder_mutex:
+    // waits until no decoder read is in flight and keeps the decode thread
+    // parked for as long as the lock is held, so current and fading can be
+    // replaced or destroyed and the ring reset. A read blocked on the network
+    // lasts until data arrives, so callers cancel the stream first when they
+    // are about to drop it anyway.
+    void wait_decoder_idle(std::unique_lock<std::mutex>& lock) {
+        if (!decoder_busy) return;
+        ++decoder_holds;
+        idle_cv.wait(lock, [&]{ return !decoder_busy; });
+        --decoder_holds;
+        idle_cv.notify_all();
+    }
+
+    // Starts overlapping the pre-rolled successor once the current track is
+    // within the crossfade window of its end. Needs the length, so tracks
+    // that do not report one fall back to a gapless splice.
+    void maybe_start_crossfade() {
+        if (settings.crossfade_seconds <= 0 || !next) return;
+        uint64_t length = current->length_frames->load();
+        ma_uint64 cursor = 0;
+        if (!length || ma_decoder_get_cursor_in_pcm_frames(&current->decoder, &cursor) != MA_SUCCESS) return;
+        cursor += current->frame_offset;
+        uint64_t window = static_cast<uint64_t>(settings.crossfade_seconds * current->decoder.outputSampleRate);
+        if (cursor + window < length) return;
+
+        std::lock_guard<std::mutex> state(state_mutex);
+        if (upcoming.empty() || next->url != upcoming.front() || !next->same_format(device)) return;
+        boundaries.push_back({ring.write_count(), next->url, next->length_frames});
+        fading = promote_next();
+        fade_total = std::max<uint64_t>(length > cursor ? length - cursor : 0, 1);
+        fade_done = 0;
+        load_cv.notify_one();
+    }
+
+    // Decodes one chunk from both tracks and writes the equal-power mix to the
+    // ring. Returns true once the outgoing track is done. Runs outside_lock().
+    bool decode_crossfade(float* in, float* out, ma_uint32 channels, bool& current_ended) {
+        ma_uint64 in_read = 0, out_read = 0;
+        ma_decoder_read_pcm_frames(&current->decoder, in, DECODE_CHUNK_FRAMES, &in_read);
+        ma_decoder_read_pcm_frames(&fading->decoder, out, DECODE_CHUNK_FRAMES, &out_read);
+        size_t frames = static_cast<size_t>(std::max(in_read, out_read));
+        std::fill(in + in_read * channels, in + frames * channels, 0.0f);
+        std::fill(out + out_read * channels, out + frames * channels, 0.0f);
+
+        const double quarter_turn = 1.5707963267948966;
+        for (size_t f = 0; f < frames; f += XFADE_SEGMENT_FRAMES) {
+            size_t n = std::min<size_t>(XFADE_SEGMENT_FRAMES, frames - f);
+            double x0 = std::min(1.0, double(fade_done + f) / fade_total) * quarter_turn;
+            double x1 = std::min(1.0, double(fade_done + f + n) / fade_total) * quarter_turn;
+            float gi = current->gain, go = fading->gain;
+            mix_gain_ramps(in + f * channels, in + f * channels, out + f * channels, n * channels,
+                           gi * float(std::sin(x0)), gi * float(std::sin(x1)),
+                           go * float(std::cos(x0)), go * float(std::cos(x1)));
+        }
+        fade_done += frames;
+        ring.write(in, frames * channels);
+
+        current_ended = in_read < DECODE_CHUNK_FRAMES;
+        return out_read < DECODE_CHUNK_FRAMES || fade_done >= fade_total;
+    }
+
+    // Runs on the decode thread with decoder_mutex held; the seek itself may
+    // read, so it runs outside_lock(), as does tearing down a crossfade. The
+    // callback drops whatever was queued before the new position on its next
+    // block.
+    void apply_seek(std::unique_lock<std::mutex>& lock) {
+        ma_uint64 frame = static_cast<ma_uint64>(seek_frame);
+        seek_frame = -1;
+        // Tearing down the old decoder may join its download thread.
+        std::unique_ptr<TrackSlot> finished = std::move(fading);
+        if (!current->index_bound && current->index_ready.load(std::memory_order_acquire)) {
+            current->index_bound = true;
+            if (!current->seek_points.empty()) {
+                auto* backend = static_cast<Mp3Backend*>(current->decoder.pBackend);
+                drmp3_bind_seek_table(&backend->mp3, static_cast<drmp3_uint32>(current->seek_points.size()),
+                                      current->seek_points.data());
+            }
+        }
+        ma_uint64 local = frame - std::min<ma_uint64>(frame, current->frame_offset);
+        ma_result seeked = MA_ERROR;
+        outside_lock(lock, [&] {
+            finished.reset();
+            seeked = ma_decoder_seek_to_pcm_frame(&current->decoder, local);
+        });
+        if (seeked != MA_SUCCESS) return;
+
+        current_done = false;
+        decoder_eof = false;
+        size_t from = ring.write_count();
+        flush_to.store(from, std::memory_order_release);
+        std::lock_guard<std::mutex> slock(state_mutex);
+        audible_start_sample = from;
+        audible_start_frame = frame;
+    }
+
+    // Scans an MP3 that is fully in memory once, on its own thread, so seeks
+    // start decoding at the nearest frame instead of at the top of the file.
+    static void build_seek_index(TrackSlot* slot, const char* bytes, size_t length) {
+        drmp3 mp3;
+        if (drmp3_init_memory(&mp3, bytes, length, nullptr)) {
+            drmp3_uint64 mp3_frames = 0, pcm_frames = 0;
+            if (drmp3_get_mp3_and_pcm_frame_count(&mp3, &mp3_frames, &pcm_frames) && mp3_frames > 0) {
+                // Roughly one point per second keeps the worst-case seek short.
+                drmp3_uint32 count = static_cast<drmp3_uint32>(std::min<drmp3_uint64>(mp3_frames, pcm_frames / mp3.sampleRate + 1));
+                std::vector<drmp3_seek_point> points(count);
+                if (drmp3_calculate_seek_points(&mp3, &count, points.data())) {
+                    points.resize(count);
+                    slot->seek_points = std::move(points);
+                }
+                uint64_t trim = uint64_t(mp3.delayInPCMFrames) + mp3.paddingInPCMFrames;
+                uint64_t frames = pcm_frames > trim ? pcm_frames - trim : 0;
+                slot->length_frames->store(frames * slot->decoder.outputSampleRate / mp3.sampleRate);
+            }
+            drmp3_uninit(&mp3);
+        }
+        slot->index_ready.store(true, std::memory_order_release);
+    }
+
+    // Makes the pre-rolled successor the current track. Caller holds both locks.
+    std::unique_ptr<TrackSlot> promote_next() {
+        upcoming.erase(upcoming.begin());
+        std::unique_ptr<TrackSlot> finished = std::move(current);
+        current = std::move(next);
+        decoding_url = current->url;
+        next_url.clear();
+        stream = current->stream;
+        current_done = false;
+        return finished;
+    }
+
+    // Called on the decode thread when the current track has hit EOF. Moves the
+    // pre-rolled successor in so its first sample follows the last one of the
+    // finished track in the ring. Returns false while the successor is still
+    // being opened, or when it needs a different device format, in which case
+    // the loader takes over once the ring has drained.
+    bool splice_next(std::unique_lock<std::mutex>& lock) {
+        std::unique_ptr<TrackSlot> finished;
+        {
+            std::lock_guard<std::mutex> state(state_mutex);
+            if (upcoming.empty()) {
+                current_done = false;
+                decoder_eof.store(true, std::memory_order_release);
+                return true;
+            }
+            if (!next || next->url != upcoming.front()) {
+                return false;
+            }
+            if (!next->same_format(device)) {
+                if (!format_switch) {
+                    format_switch = true;
+                    draining = true;
+                    load_cv.notify_one();
+                }
+                return false;
+            }
+            boundaries.push_back({ring.write_count(), next->url, next->length_frames});
+            finished = promote_next();
+        }
+        load_cv.notify_one();
+
+        // Tearing down the old decoder may join its download thread.
+        lock.unlock();
+        finished.reset();
+        lock.lock();
+        return true;
+    }
+    
+    // Aborts a whole-file download as soon as a newer play() request arrives.
+    static int load_progress_callback(void* clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+        return static_cast<LoadToken*>(clientp)->stale() ? 1 : 0;
+    }
+
+    static int stream_progress_callback(void* clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+        return static_cast<StreamBuffer*>(clientp)->is_interrupted() ? 1 : 0;
+    }
+
+    static ma_result stream_read(ma_decoder* pDecoder, void* pBufferOut, size_t bytesToRead, size_t* pBytesRead) {
+        auto* buf = static_cast<StreamBuffer*>(pDecoder->pUserData);
+        *pBytesRead = buf->read(pBufferOut, bytesToRead);
+        return (*pBytesRead == 0 && bytesToRead > 0) ? MA_AT_END : MA_SUCCESS;
+    }
+
+    static ma_result stream_seek(ma_decoder* pDecoder, ma_int64 byteOffset, ma_seek_origin origin) {
+        auto* buf = static_cast<StreamBuffer*>(pDecoder->pUserData);
+        return buf->seek(byteOffset, origin) ? MA_SUCCESS : MA_BAD_SEEK;
+    }
+
+    // Bytes on their way into the cache. The write callback queues them on the
+    // I/O thread, which must not wait on the disk; the download thread writes them.
+    class CacheTee {
+    public:
+        void push(const char* data, size_t len) {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (len) chunks.emplace_back(data, len);
+            cv.notify_one();
+        }
+
+        // The transfer has ended; runs on the I/O thread.
+        void close() {
+            std::lock_guard<std::mutex> lock(mtx);
+            closed = true;
+            cv.notify_one();
+        }
+
+        // Download thread: appends queued bytes to `writer` until close(),
+        // then rearms for the next transfer.
+        void drain(AudioCache::Writer* writer) {
+            std::unique_lock<std::mutex> lock(mtx);
+            while (true) {
+                cv.wait(lock, [&]{ return !chunks.empty() || closed; });
+                if (chunks.empty()) break;
+                std::deque<std::string> batch;
+                batch.swap(chunks);
+                lock.unlock();
+                for (auto& c : batch) {
+                    if (writer) writer->append(c.data(), c.size());
+                }
+                lock.lock();
+            }
+            closed = false;
+        }
 
-const std::string VERSION = "2.0";
+    private:
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<std::string> chunks;
+        bool closed = false;
+    };
 
-// ─────────────────────────────────────────────────────────────────────────────
-// Audio playback system
-// ─────────────────────────────────────────────────────────────────────────────
+    struct StreamTransfer {
+        CURL* curl;
+        StreamBuffer* buffer;
+        CacheTee* tee;                  // tees the stream into the cache, may be null
+        bool length_known;
+        uint64_t offset;                // bytes the buffer already holds
+        uint64_t skip;                  // bytes of a 200 reply to drop because of that
+    };
 
-class AudioPlayer {
-private:
-    ma_device device;
-    ma_decoder decoder;
-    std::atomic<bool> is_playing{false};
-    std::atomic<bool> is_paused{false};
-    std::atomic<float> volume{1.0f};
-    std::atomic<bool> should_stop{false};
-    std::thread playback_thread;
-    std::mutex decoder_mutex;
-    std::condition_variable cv;
-    std::vector<float> audio_buffer;
-    std::string current_url;
-    
-    static void data_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount) {
-        AudioPlayer* player = static_cast<AudioPlayer*>(pDevice->pUserData);
-        player->fill_buffer(pOutput, frameCount);
-    }
-    
-    void fill_buffer(void* pOutput, ma_uint32 frameCount) {
-        std::lock_guard<std::mutex> lock(decoder_mutex);
-        
-        if (!is_playing || is_paused) {
-            memset(pOutput, 0, frameCount * device.playback.channels * sizeof(float));
-            return;
-        }
-        
-        ma_uint64 framesRead;
-        ma_result result = ma_decoder_read_pcm_frames(&decoder, pOutput, frameCount, &framesRead);
-        
-        if (framesRead < frameCount) {
-            // End of track
-            is_playing = false;
-            memset(static_cast<char*>(pOutput) + framesRead * device.playback.channels * sizeof(float), 
-                   0, (frameCount - framesRead) * device.playback.channels * sizeof(float));
+    static size_t stream_write_callback(void* contents, size_t size, size_t nmemb, void* userp) {
+        auto* xfer = static_cast<StreamTransfer*>(userp);
+        char* bytes = static_cast<char*>(contents);
+        size_t total = size * nmemb;
+        if (!xfer->length_known) {
+            curl_off_t len = -1;
+            long code = 0;
+            curl_easy_getinfo(xfer->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &len);
+            curl_easy_getinfo(xfer->curl, CURLINFO_RESPONSE_CODE, &code);
+            if (code == 200) {
+                xfer->skip = xfer->offset;      // the server ignored the Range header
+            } else if (len >= 0) {
+                len += xfer->offset;            // 206, or a non-HTTP source that honours ranges
+            }
+            xfer->buffer->set_content_length(len);
+            xfer->length_known = true;
         }
-        
-        // Apply volume
-        float* samples = static_cast<float*>(pOutput);
-        for (ma_uint32 i = 0; i < frameCount * device.playback.channels; ++i) {
-            samples[i] *= volume.load();
+        // A paused chunk is delivered again in full, so nothing is consumed
+        // until the buffer has taken it.
+        size_t dropped = static_cast<size_t>(std::min<uint64_t>(xfer->skip, total));
+        if (!xfer->buffer->write(bytes + dropped, total - dropped)) {
+            return xfer->buffer->is_interrupted() ? 0 : CURL_WRITEFUNC_PAUSE;
         }
+        xfer->skip -= dropped;
+        if (xfer->tee) xfer->tee->push(bytes + dropped, total - dropped);
+        return total;
     }
-    
-    static size_t curl_write_callback(void* contents, size_t size, size_t nmemb, void* userp) {
-        std::vector<char>* buffer = static_cast<std::vector<char>*>(userp);
-        size_t total_size = size * nmemb;
-        buffer->insert(buffer->end(), static_cast<char*>(contents), 
-                      static_cast<char*>(contents) + total_size);
-        return total_size;
+
+    // `offset` bytes are already in the buffer (and the writer); the rest is
+    // requested with a Range header. A dropped connection is resumed from the
+    // last byte received, so the reader only notices if the buffered bytes run
+    // out first. The thread then stays around to serve jumps until cancelled.
+    static void stream_download(std::string url, std::shared_ptr<StreamBuffer> buffer,
+                                std::unique_ptr<AudioCache::Writer> writer, uint64_t offset) {
+        auto http = http_client().acquire();
+        CURL* curl = http.get();
+        if (!curl) { buffer->finish(false); return; }
+
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, stream_write_callback);
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, stream_progress_callback);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, buffer.get());
+        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+        buffer->set_producer_wakeup([curl]{ http_client().resume(curl); });
+        // A connection that went quiet is treated like one that dropped.
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 15L);
+
+        CacheTee tee;
+        unsigned failures = 0;
+        while (true) {
+            int64_t jump = buffer->take_restart();
+            if (jump >= 0) {
+                offset = static_cast<uint64_t>(jump);
+                writer.reset();         // the cache only takes contiguous files
+                failures = 0;
+            }
+            StreamTransfer xfer{curl, buffer.get(), writer ? &tee : nullptr, false, offset, 0};
+            std::string range = std::to_string(offset) + "-";
+            curl_easy_setopt(curl, CURLOPT_RANGE, offset ? range.c_str() : nullptr);
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &xfer);
+
+            auto running = http.start([&tee](CURLcode){ tee.close(); });
+            tee.drain(writer.get());
+            CURLcode res = running.get();
+            long code = 0;
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+            if (buffer->is_cancelled()) break;
+            if (buffer->is_interrupted()) continue;     // a jump: re-request from its offset
+            if (code == 416) {
+                buffer->set_content_length(offset);     // nothing past the offset: the file is complete
+                res = CURLE_OK;
+            }
+
+            uint64_t received = buffer->bytes_received();
+            failures = received > offset ? 1 : failures + 1;   // progress before a drop restarts the backoff
+            offset = received;
+            bool done = res == CURLE_OK;
+            if (done) {
+                if (writer) writer->commit();
+                writer.reset();
+                buffer->finish(true);
+            } else if ((code >= 400 && code < 500) || failures > STREAM_RETRIES) {
+                writer.reset();
+                buffer->finish(false);
+                done = true;
+            }
+            if (done) {
+                if (!buffer->wait_for_restart()) break;
+                continue;
+            }
+            unsigned delay = std::min(RETRY_MAX_MS, RETRY_BASE_MS << std::min(failures - 1, 8u));
+            if (!buffer->wait_for_restart(std::chrono::milliseconds(delay))) break;
+        }
+        buffer->set_producer_wakeup(nullptr);
     }
-    
-    bool download_and_decode(const std::string& url) {
-        CURL* curl = curl_easy_init();
-        if (!curl) return false;
+
+    std::shared_ptr<std::vector<char>> download_whole(const std::string& url, const LoadToken& token) {
+        auto http = http_client().acquire();
+        CURL* curl = http.get();
+        if (!curl) return nullptr;
         
-        std::vector<char> audio_data;
+        LoadToken progress = token;
+        PooledDownload download{&buffers, curl};
         
         curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &audio_data);
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, PooledDownload::write_callback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &download);
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, load_progress_callback);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &progress);
         
-        CURLcode res = curl_easy_perform(curl);
-        curl_easy_cleanup(curl);
+        CURLcode res = http.perform();
         
-        if (res != CURLE_OK || audio_data.empty()) {
-            return false;
+        if (res != CURLE_OK || download.size() == 0) return nullptr;
+        return std::move(download.data);
+    }
+
+    // In passthrough mode the decoder keeps the source's rate and channel
+    // count and the device follows it; otherwise miniaudio converts to 44.1k stereo.
+    ma_decoder_config decoder_config(const std::string& url) const {
+        return settings.passthrough ? decoder_config_for(url, 0, 0)
+                                    : decoder_config_for(url, DEFAULT_CHANNELS, DEFAULT_SAMPLE_RATE);
+    }
+
+    // Opens a track without touching any shared decoder state. In streaming
+    // mode curl fills a bounded window on its own thread and the decoder pulls
+    // from it, so this returns after the first few KB. A non-zero `start_ticks`
+    // asks the server for a transcode from that position, which is always
+    // streamed and never cached.
+    std::unique_ptr<TrackSlot> open_slot(const std::string& url, const LoadToken& token, uint64_t start_ticks = 0) {
+        auto slot = std::make_unique<TrackSlot>();
+        std::shared_ptr<const std::vector<char>> head;     // speculatively fetched start of the file
+        slot->url = url;
+        slot->gain = normalization_gain(url);
+        ma_decoder_config decoderConfig = decoder_config(url);
+
+        const char* bytes = nullptr;
+        size_t length = 0;
+        bool store = false;     // data is a whole download the cache does not have yet
+        if (start_ticks) {
+            // Straight to the stream below.
+        } else if ((slot->mapped = cache.open(url))) {
+            bytes = slot->mapped->data();
+            length = slot->mapped->size();
+        } else {
+            HeadFetcher::Head spec = heads.take(url);
+            slot->data = prefetcher.lookup(url);
+            if (!slot->data && spec.complete) {
+                slot->data = std::move(spec.data);
+                store = true;
+            }
+            head = std::move(spec.data);
+            if (!slot->data && !settings.streaming) {
+                auto data = download_whole(url, token);
+                if (!data || token.stale()) return nullptr;
+                slot->data = std::move(data);
+                store = true;
+            }
+            if (slot->data) {
+                bytes = slot->data->data();
+                length = slot->data->size();
+            }
         }
-        
-        // Decode MP3 data
-        std::lock_guard<std::mutex> lock(decoder_mutex);
-        
-        ma_decoder_uninit(&decoder);
-        
-        ma_decoder_config decoderConfig = ma_decoder_config_init(ma_format_f32, 2, 44100);
-        ma_result result = ma_decoder_init_memory(audio_data.data(), audio_data.size(), &decoderConfig, &decoder);
-        if (result != MA_SUCCESS) {
+        if (bytes) {
+            if (ma_decoder_init_memory(bytes, length, &decoderConfig, &slot->decoder) != MA_SUCCESS) {
+                return nullptr;
+            }
+            slot->decoder_ready = true;
+            if (store && cache.enabled()) {
+                // Writing and syncing the file can take a while; the slot joins it.
+                slot->download = std::thread([this, url, data = slot->data] { cache.store(url, *data); });
+            }
+            if (settings.lock_memory) slot->lock_memory();
+            if (slot->is_mp3()) {
+                slot->indexer = std::thread(build_seek_index, slot.get(), bytes, length);
+            } else {
+                read_length(*slot);
+            }
+            return slot;
+        }
+
+        slot->stream = std::make_shared<StreamBuffer>(buffers.acquire(settings.stream_buffer_bytes),
+                                                      settings.stream_buffer_bytes,
+                                                      settings.stream_buffer_bytes / 8);
+        slot->stream->set_finish_callback([this]{
+            { std::lock_guard<std::mutex> lock(state_mutex); }      // not between the loader's check and its wait
+            load_cv.notify_all();
+        });
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            pending_stream = slot->stream;
+            if (token.stale()) slot->stream->cancel();
+        }
+        // Start from the speculative head, if any, and fetch only what follows it.
+        std::unique_ptr<AudioCache::Writer> writer = start_ticks ? nullptr : cache.writer(url);
+        uint64_t offset = 0;
+        if (head && slot->stream->write(head->data(), head->size())) {
+            offset = head->size();
+            if (writer) writer->append(head->data(), head->size());
+        }
+        std::string source = start_ticks ? url + "&StartTimeTicks=" + std::to_string(start_ticks) : url;
+        slot->download = std::thread(stream_download, source, slot->stream, std::move(writer), offset);
+
+        bool ok = slot->stream->wait_for_bytes(settings.stream_start_bytes) && !token.stale()
+               && ma_decoder_init(stream_read, stream_seek, slot->stream.get(), &decoderConfig, &slot->decoder) == MA_SUCCESS;
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            pending_stream.reset();
+        }
+        if (!ok) return nullptr;
+        slot->decoder_ready = true;
+        if (settings.lock_memory) slot->lock_memory();
+        read_length(*slot);
+        return slot;
+    }
+
+    // ReplayGain-style: bring the track to the target loudness, but never push
+    // its true peak above -1 dBTP. Unmeasured tracks play unchanged.
+    float normalization_gain(const std::string& url) {
+        LoudnessAnalyzer::Result r;
+        if (!loudness) return 1.0f;
+        loudness->request(url);
+        if (!loudness->lookup(url, r) || r.lufs <= -70.0) return 1.0f;
+        double gain = std::pow(10.0, (settings.normalize_target_lufs - r.lufs) / 20.0);
+        if (r.peak > 0.0) gain = std::min(gain, std::pow(10.0, -1.0 / 20.0) / r.peak);
+        return static_cast<float>(gain);
+    }
+
+    // Only called where the length is cheap: headers for WAV/FLAC, the Xing
+    // frame for a streamed MP3 (which reports nothing without one).
+    static void read_length(TrackSlot& slot) {
+        ma_uint64 frames = 0;
+        if (ma_decoder_get_length_in_pcm_frames(&slot.decoder, &frames) == MA_SUCCESS) {
+            slot.length_frames->store(frames);
+        }
+    }
+
+    // Playing time of what the ring holds, and at least one device period.
+    std::chrono::microseconds queued_duration() const {
+        uint64_t frames = ring.readable() / std::max<ma_uint32>(output_channels, 1);
+        uint64_t period = device_buffer_us / std::max<ma_uint32>(device_periods, 1);
+        return std::chrono::microseconds(std::max(frames * 1000000 / std::max<ma_uint32>(output_rate, 1), period));
+    }
+
+    // Sets the amount wait_for_prebuffer() waits for. Both locks held, with a
+    // fresh track in current that the decode thread has not been woken for.
+    void arm_prebuffer() {
+        prebuffer_target = std::min(settings.stream_start_frames * device.playback.channels,
+                                    ring.writable() + ring.readable());
+    }
+
+    // Holds the device back until enough PCM is queued to ride out the first
+    // network hiccup. The decode thread says when, see release_prebuffer().
+    void wait_for_prebuffer(const LoadToken& token) {
+        std::unique_lock<std::mutex> lock(state_mutex);
+        load_cv.wait(lock, [&]{ return !prebuffer_target || token.stale(); });
+        prebuffer_target = 0;
+    }
+
+    // Decode thread: lets wait_for_prebuffer() go once the ring holds the
+    // target, or once `done` says no more is coming for now.
+    void release_prebuffer(bool done) {
+        size_t target = prebuffer_target.load(std::memory_order_relaxed);
+        if (!target || (!done && ring.readable() < target)) return;
+        {
+            std::lock_guard<std::mutex> slock(state_mutex);
+            prebuffer_target = 0;
+        }
+        load_cv.notify_all();
+    }
+
+    // Runs on load_thread. Explicit requests come first: only the newest one is
+    // loaded, and anything that arrives while a load is in flight bumps
+    // load_generation, which aborts the transfer and suppresses the stale
+    // completion event. When idle, the loader pre-rolls the head of the
+    // upcoming list once the current track has finished downloading.
+    void load_loop() {
+        std::unique_lock<std::mutex> lock(state_mutex);
+        while (!loader_exit) {
+            if (request_pending) {
+                std::string url = requested_url;
+                LoadToken token{&load_generation, load_generation.load()};
+                request_pending = false;
+                lock.unlock();
+
+                bool ok = load_and_start(url, token);
+
+                lock.lock();
+                if (!token.stale()) {
+                    loading = false;
+                    events.push_back({ok ? PlayerEvent::STARTED : PlayerEvent::FAILED, url});
+                }
+                continue;
+            }
+
+            if (profile_pending) {
+                size_t index = requested_profile;
+                profile_pending = false;
+                lock.unlock();
+                apply_latency_profile(index);
+                lock.lock();
+                continue;
+            }
+
+            if (reopen_frame >= 0) {
+                std::string url = reopen_url;
+                uint64_t frame = static_cast<uint64_t>(reopen_frame);
+                LoadToken token{&load_generation, load_generation.load()};
+                reopen_frame = -1;
+                lock.unlock();
+                reopen_at(url, frame, token);
+                lock.lock();
+                continue;
+            }
+
+            if (format_switch && is_playing) {
+                LoadToken token{&load_generation, load_generation.load(), &queue_generation, queue_generation.load()};
+                lock.unlock();
+                switch_format(token);
+                lock.lock();
+                continue;
+            }
+
+            bool wants_preroll = !decoding_url.empty() && !upcoming.empty() && next_url != upcoming.front();
+            if (!wants_preroll) {
+                load_cv.wait(lock);
+                continue;
+            }
+            if (stream && !stream->is_complete()) {
+                // One download at a time: the stream's finish callback wakes us.
+                load_cv.wait(lock);
+                continue;
+            }
+
+            std::string url = upcoming.front();
+            LoadToken token{&load_generation, load_generation.load(), &queue_generation, queue_generation.load()};
+            lock.unlock();
+            preroll(url, token);
+            lock.lock();
+        }
+    }
+
+    void preroll(const std::string& url, const LoadToken& token) {
+        std::unique_ptr<TrackSlot> slot = open_slot(url, token);
+        std::unique_ptr<TrackSlot> replaced;
+        {
+            auto dlock = lock_decoder();
+            std::lock_guard<std::mutex> slock(state_mutex);
+            bool still_wanted = !token.stale() && current && !upcoming.empty() && upcoming.front() == url;
+            if (slot && still_wanted) {
+                replaced = std::move(next);
+                next = std::move(slot);
+                next_url = url;
+            } else if (!slot && still_wanted) {
+                // Skip tracks that cannot be opened rather than stalling the queue.
+                events.push_back({PlayerEvent::FAILED, url});
+                upcoming.erase(upcoming.begin());
+                ++queue_generation;
+            }
+        }
+        wake_decoder();
+    }
+
+    // Plays out what is left of the ring, then re-opens the device at the
+    // successor's format and promotes it. Costs a short gap instead of a
+    // resampled track.
+    void switch_format(const LoadToken& token) {
+        {
+            // The callback cannot signal, so sleep for as long as what is queued
+            // takes to play; new requests wake the loader early.
+            std::unique_lock<std::mutex> lock(state_mutex);
+            while (ring.readable() > 0 && is_playing && !token.stale()) {
+                if (profile_pending) {
+                    // The drain can last as long as the ring.
+                    lock.unlock();
+                    take_profile_request();
+                    lock.lock();
+                    continue;
+                }
+                load_cv.wait_for(lock, queued_duration());
+            }
+        }
+
+        std::unique_ptr<TrackSlot> finished;
+        {
+            auto dlock = lock_decoder();
+            wait_decoder_idle(dlock);
+            std::lock_guard<std::mutex> slock(state_mutex);
+            format_switch = false;
+            draining = false;
+            if (token.stale() || !is_playing || !current_done || !next
+                || upcoming.empty() || next->url != upcoming.front()) {
+                return;     // the decode thread re-raises it if still needed
+            }
+            ma_device_stop(&device);
+            if (!configure_device(next->decoder.outputChannels, next->decoder.outputSampleRate)) {
+                events.push_back({PlayerEvent::FAILED, next->url});
+                finished = std::move(next);
+                next_url.clear();
+                upcoming.erase(upcoming.begin());
+                ++queue_generation;
+                if (device_open) start_device();
+            } else {
+                // The ring restarts at zero, so settle the boundaries it has
+                // already played past before they lose their meaning.
+                for (auto& b : boundaries) events.push_back({PlayerEvent::ADVANCED, b.url});
+                boundaries.clear();
+                finished = promote_next();
+                current_url = decoding_url;
+                audible_start_sample = ring.write_count();
+                audible_start_frame = 0;
+                audible_length = current->length_frames;
+                events.push_back({PlayerEvent::ADVANCED, current_url});
+                arm_prebuffer();
+            }
+        }
+        wake_decoder();
+        finished.reset();
+        if (!device_open) return;
+
+        wait_for_prebuffer(token);
+        start_device();
+    }
+
+    // Re-opens the device when the format differs. Only called with the device
+    // stopped and decoder_mutex held, so nothing touches the ring meanwhile.
+    bool configure_device(ma_uint32 channels, ma_uint32 rate) {
+        if (device_open && channels == device.playback.channels && rate == device.sampleRate) {
+            return true;
+        }
+        ma_uint32 old_channels = output_channels, old_rate = output_rate;
+        if (device_open) ma_device_uninit(&device);
+        device_open = open_device(channels, rate);
+        if (!device_open && old_channels) {
+            device_open = open_device(old_channels, old_rate);
             return false;
         }
-        
+        return device_open;
+    }
+
+    ma_result start_device() {
+        callback_resync = true;
+        output_suspended = false;
+        diagnostics.period_ns = device_buffer_us * 1000 / std::max<ma_uint32>(device_periods, 1);    // seeds the average
+        return ma_device_start(&device);
+    }
+
+    // decoder_mutex for threads other than the decode thread; contended
+    // acquisitions are timed. The decode thread never holds it across I/O.
+    std::unique_lock<std::mutex> lock_decoder() {
+        std::unique_lock<std::mutex> lock(decoder_mutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            uint64_t start = now_ns();
+            lock.lock();
+            diagnostics.lock_wait_time.record(now_ns() - start);
+        }
+        return lock;
+    }
+
+    bool open_device(ma_uint32 channels, ma_uint32 rate) {
+        if (!init_device(channels, rate)) return false;
+        ring.reset(static_cast<size_t>(device.sampleRate) * device.playback.channels * RING_SECONDS);
+        if (settings.lock_memory) ring.lock_memory();
+        flush_to = 0;
         return true;
     }
 
-public:
-    AudioPlayer() {
+    // Leaves the ring alone, so a profile change can re-open the device
+    // without losing what is queued.
+    bool init_device(ma_uint32 channels, ma_uint32 rate) {
+        const LatencyProfile& profile = LATENCY_PROFILES[latency_profile.load()];
         ma_device_config deviceConfig = ma_device_config_init(ma_device_type_playback);
         deviceConfig.playback.format = ma_format_f32;
-        deviceConfig.playback.channels = 2;
-        deviceConfig.sampleRate = 44100;
+        deviceConfig.playback.channels = channels;
+        deviceConfig.sampleRate = rate;
+        deviceConfig.periodSizeInMilliseconds = profile.period_ms;
+        deviceConfig.periods = profile.periods;
+        deviceConfig.performanceProfile = profile.performance;
         deviceConfig.dataCallback = data_callback;
+        deviceConfig.notificationCallback = notification_callback;
         deviceConfig.pUserData = this;
-        
-        if (ma_device_init(nullptr, &deviceConfig, &device) != MA_SUCCESS) {
-            throw std::runtime_error("Failed to initialize audio device");
+
+        if (ma_device_init(context_ready ? &context : nullptr, &deviceConfig, &device) != MA_SUCCESS) {
+            return false;
         }
-        
-        // Initialize decoder with empty data
-        ma_decoder_config decoderConfig = ma_decoder_config_init(ma_format_f32, 2, 44100);
-        ma_decoder_init_memory(nullptr, 0, &decoderConfig, &decoder);
+        callback_seen = false;
+        callback_pinned = false;
+        output_channels = device.playback.channels;
+        output_rate = device.sampleRate;
+        refresh_eq(device.sampleRate);
+        device_periods = device.playback.internalPeriods;
+        device_buffer_us = uint64_t(device.playback.internalPeriodSizeInFrames) * device.playback.internalPeriods
+                         * 1000000 / std::max<ma_uint32>(device.playback.internalSampleRate, 1);
+        return true;
     }
-    
-    ~AudioPlayer() {
-        stop();
-        ma_decoder_uninit(&decoder);
+
+    // Compiles the selected preset for the device rate and hands it to the
+    // callback. Compiled sets are never freed while the player lives, so the
+    // callback cannot be left holding a dangling one. The preset (from the
+    // UI) and the rate (from the loader) change and are published under one
+    // lock, so the last publish always matches both.
+    void refresh_eq(ma_uint32 rate) {
+        std::lock_guard<std::mutex> lock(eq_mutex);
+        eq_rate = rate;
+        publish_eq();
+    }
+
+    // Caller holds eq_mutex.
+    void publish_eq() {
+        size_t index = eq_index.load();
+        auto& compiled = eq_compiled[{index, eq_rate}];
+        if (!compiled) compiled = compile_eq(settings.eq_presets[index], eq_rate);
+        eq->publish(compiled.get());
+    }
+
+    void take_profile_request() {
+        size_t index;
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            if (!profile_pending) return;
+            profile_pending = false;
+            index = requested_profile;
+        }
+        apply_latency_profile(index);
+    }
+
+    // Runs on the loader thread, which owns the device.
+    void apply_latency_profile(size_t index) {
+        auto dlock = lock_decoder();
+        size_t previous = latency_profile.exchange(index);
+        if (!device_open || previous == index) return;
+        bool running = ma_device_is_started(&device);
         ma_device_uninit(&device);
+        device_open = init_device(output_channels, output_rate);
+        if (!device_open) {
+            latency_profile = previous;
+            device_open = init_device(output_channels, output_rate);
+        }
+        if (device_open && running) start_device();
     }
-    
-    bool play(const std::string& url) {
-        if (url == current_url && is_playing) {
-            return true; // Already playing this track
+
+    // Replaces the current transcode with one the server starts at `frame`.
+    // The old stream keeps playing until the new one has opened; if the new
+    // one cannot be used, the seek falls back to reading forward.
+    void reopen_at(const std::string& url, uint64_t frame, const LoadToken& token) {
+        uint64_t ticks;
+        {
+            auto dlock = lock_decoder();
+            if (!current || current->url != url) return;
+            ticks = frame * 10000000 / current->decoder.outputSampleRate;
         }
-        
-        stop();
-        
-        if (!download_and_decode(url)) {
-            return false;
+        std::unique_ptr<TrackSlot> slot = open_slot(url, token, ticks);
+
+        // Destroyed after the locks are dropped, since that may join download threads.
+        std::unique_ptr<TrackSlot> old, old_fading;
+        {
+            auto dlock = lock_decoder();
+            if (!current || current->url != url || token.stale()) return;
+            if (!slot || !slot->same_format(device)) {
+                seek_frame = static_cast<int64_t>(frame);
+            } else {
+                // The old streams are being dropped, so unblock a read waiting on them.
+                if (current->stream) current->stream->cancel();
+                if (fading && fading->stream) fading->stream->cancel();
+                wait_decoder_idle(dlock);
+                if (!current || current->url != url || token.stale()) return;
+                slot->frame_offset = frame;
+                slot->length_frames = current->length_frames;
+                slot->gain = current->gain;
+                old = std::move(current);
+                old_fading = std::move(fading);
+                current = std::move(slot);
+                seek_frame = -1;
+                current_done = false;
+                decoder_eof = false;
+                size_t from = ring.write_count();
+                flush_to.store(from, std::memory_order_release);
+                std::lock_guard<std::mutex> slock(state_mutex);
+                audible_start_sample = from;
+                audible_start_frame = frame;
+                stream = current->stream;
+            }
+        }
+        wake_decoder();
+    }
+
+    bool load_and_start(const std::string& url, const LoadToken& token) {
+        halt_output();
+
+        // Reuse the pre-rolled track when the user jumps straight to it.
+        std::unique_ptr<TrackSlot> slot;
+        {
+            auto dlock = lock_decoder();
+            if (next && next->url == url) {
+                slot = std::move(next);
+                std::lock_guard<std::mutex> slock(state_mutex);
+                next_url.clear();
+            }
+        }
+        if (!slot) slot = open_slot(url, token);
+        if (!slot || token.stale()) return false;
+
+        std::unique_ptr<TrackSlot> old_current, old_next, old_fading;
+        {
+            // The device is stopped, so nothing reads the ring while it is reset.
+            // halt_output() cancelled the stream, so a decoder read ends promptly.
+            auto dlock = lock_decoder();
+            wait_decoder_idle(dlock);
+            if (!configure_device(slot->decoder.outputChannels, slot->decoder.outputSampleRate)) {
+                return false;
+            }
+            old_current = std::move(current);
+            old_next = std::move(next);
+            old_fading = std::move(fading);
+            current = std::move(slot);
+            current_done = false;
+            ring.clear();
+            decoder_eof = false;
+
+            seek_frame = -1;
+            flush_to = 0;
+
+            std::lock_guard<std::mutex> slock(state_mutex);
+            format_switch = false;
+            draining = false;
+            audible_start_sample = ring.write_count();
+            audible_start_frame = 0;
+            audible_length = current->length_frames;
+            decoding_url = url;
+            next_url.clear();
+            boundaries.clear();
+            stream = current->stream;
+            arm_prebuffer();
         }
+        wake_decoder();
+        load_cv.notify_all();
+        old_current.reset();
+        old_next.reset();
+        old_fading.reset();
+
+        wait_for_prebuffer(token);
+        if (token.stale()) return false;
         
-        current_url = url;
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            current_url = url;
+        }
         is_playing = true;
         is_paused = false;
         
-        if (ma_device_start(&device) != MA_SUCCESS) {
+        if (!device_open || start_device() != MA_SUCCESS) {
             is_playing = false;
             return false;
         }
         
         return true;
     }
-    
-    void stop() {
+
+    void halt_output() {
         is_playing = false;
         is_paused = false;
-        should_stop = true;
         
-        ma_device_stop(&device);
-        current_url.clear();
+        // Wake a decoder blocked on network data so it releases decoder_mutex.
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            if (stream) stream->cancel();
+            current_url.clear();
+        }
+        if (device_open) ma_device_stop(&device);
+    }
+
+    // Tunes the decode thread and records what actually took effect.
+    void apply_realtime_settings() {
+        std::vector<std::string> parts;
+        if (settings.rt_priority > 0) {
+            parts.push_back("decode " + set_realtime_priority(decode_thread.native_handle(), settings.rt_priority));
+            parts.push_back(context_ready ? "audio thread realtime requested" : "audio thread default");
+        }
+        if (!settings.cpu_affinity.empty()) {
+            parts.push_back(pin_thread(decode_thread.native_handle(), settings.cpu_affinity));
+        }
+        if (settings.lock_memory) {
+            rlimit lim{};
+            std::string limit = getrlimit(RLIMIT_MEMLOCK, &lim) == 0 && lim.rlim_cur != RLIM_INFINITY
+                              ? " of " + std::to_string(lim.rlim_cur / 1024) + " KB" : "";
+            parts.push_back(ring.lock_memory() ? "ring " + std::to_string(ring.bytes() / 1024) + " KB locked"
+                                               : "mlock refused (limit" + limit + ")");
+        }
+        for (auto& p : parts) rt_report += (rt_report.empty() ? "" : ", ") + p;
+    }
+
+    // Catches the audible-track state up with what the device has played.
+    // Caller holds state_mutex.
+    void settle_boundaries() {
+        while (!boundaries.empty() && ring.read_count() >= boundaries.front().sample_pos) {
+            TrackBoundary& b = boundaries.front();
+            current_url = b.url;
+            audible_start_sample = b.sample_pos;
+            audible_start_frame = 0;
+            audible_length = b.length_frames;
+            events.push_back({PlayerEvent::ADVANCED, current_url});
+            boundaries.pop_front();
+        }
+    }
+
+public:
+    explicit AudioPlayer(const PlayerSettings& s = PlayerSettings())
+      : settings(s),
+        buffers(s.prefetch_max_bytes + 2 * s.stream_buffer_bytes),     // the prefetch set plus two stream windows
+        cache(s.cache_dir, s.cache_max_bytes),
+        prefetcher(s.prefetch_max_bytes, &cache, &buffers),
+        heads(s.speculative_bytes, static_cast<curl_off_t>(s.speculative_max_rate), &cache, &buffers) {
+        if (settings.normalize && cache.enabled()) {
+            loudness = std::make_unique<LoudnessAnalyzer>(settings.cache_dir, settings.loudness_threads,
+                [this](const std::string& url) {
+                    LoudnessAnalyzer::Source src;
+                    if (auto m = cache.peek(url)) {
+                        src.data = m->data();
+                        src.size = m->size();
+                        src.owner = std::move(m);
+                    }
+                    return src;
+                });
+            cache.on_commit = [this](const std::string& url) { loudness->request(url); };
+        }
+
+        if (settings.rt_priority > 0) {
+            // miniaudio raises the threads it owns when asked through its context.
+            ma_context_config contextConfig = ma_context_config_init();
+            contextConfig.threadPriority = ma_thread_priority_realtime;
+            context_ready = ma_context_init(nullptr, 0, &contextConfig, &context) == MA_SUCCESS;
+        }
+        latency_profile = latency_profile_index(settings.latency_profile);
+        for (size_t i = 0; i < settings.eq_presets.size(); ++i) {
+            if (settings.eq_presets[i].name == settings.eq_preset) eq_index = i;
+        }
+        eq = dsp.add(std::make_unique<EqStage>());
+        dsp.add(std::make_unique<VolumeStage>(volume));
+        device_open = open_device(DEFAULT_CHANNELS, DEFAULT_SAMPLE_RATE);
+        if (!device_open) {
+            if (context_ready) ma_context_uninit(&context);
+            throw std::runtime_error("Failed to initialize audio device");
+        }
+        
+        decode_thread = std::thread(&AudioPlayer::decode_loop, this);
+        apply_realtime_settings();
+        load_thread = std::thread(&AudioPlayer::load_loop, this);
+    }
+    
+    ~AudioPlayer() {
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            loader_exit = true;
+        }
+        stop();
+        load_cv.notify_all();
+        if (load_thread.joinable()) load_thread.join();
+        {
+            auto lock = lock_decoder();
+            should_stop = true;
+        }
+        wake_decoder();
+        if (decode_thread.joinable()) decode_thread.join();
+        current.reset();
+        next.reset();
+        fading.reset();
+        if (device_open) ma_device_uninit(&device);
+        if (context_ready) ma_context_uninit(&context);
+    }
+    
+    // Asynchronous: returns immediately and reports the outcome through
+    // poll_event(). A newer request cancels one that is still loading.
+    void play(const std::string& url) {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        if (url == current_url && is_playing && !request_pending) {
+            return; // Already playing this track
+        }
+        
+        ++load_generation;
+        if (pending_stream) pending_stream->cancel();
+        if (stream) stream->cancel();
+        requested_url = url;
+        request_pending = true;
+        loading = true;
+        load_cv.notify_one();
+    }
+    
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            ++load_generation;
+            request_pending = false;
+            loading = false;
+            if (pending_stream) pending_stream->cancel();
+        }
+        load_cv.notify_all();   // ends a format-switch drain
+        halt_output();
+    }
+    
+    // Tracks to play after the current one, in order. The engine opens the
+    // head of this list ahead of time and splices it in without stopping the
+    // device.
+    void set_upcoming(std::vector<std::string> urls) {
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            // Tracks already spliced in but not yet audible are no longer
+            // upcoming, even if the caller has not caught up with them yet.
+            for (auto& b : boundaries) {
+                if (!urls.empty() && urls.front() == b.url) urls.erase(urls.begin());
+            }
+            if (urls.empty() || upcoming.empty() || urls.front() != upcoming.front()) {
+                ++queue_generation;
+                if (pending_stream && !request_pending && !loading) pending_stream->cancel();
+            }
+            upcoming = std::move(urls);
+            if (loudness) {
+                for (auto& u : upcoming) loudness->request(u);
+            }
+            size_t n = std::min(settings.prefetch_count, upcoming.size());
+            prefetcher.set_wanted(std::vector<std::string>(upcoming.begin(), upcoming.begin() + n));
+        }
+        load_cv.notify_all();
+        wake_decoder();
+    }
+    
+    bool poll_event(PlayerEvent& ev) {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        settle_boundaries();
+        if (events.empty()) return false;
+        ev = std::move(events.front());
+        events.pop_front();
+        return true;
     }
     
     void pause() {
         is_paused = true;
     }
     
+    // Like seek_to(), neither waits for the decoder: the device is started
+    // or stopped by the decode thread.
     void resume() {
         is_paused = false;
+        if (output_suspended) {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            output_request = OUTPUT_START;
+        }
+        wake_decoder();
+    }
+
+    // Stops the device while nothing is audible, so an idle player causes no
+    // wakeups. resume() and the next load start it again.
+    void suspend_output() {
+        if (output_suspended || loading || (is_playing && !is_paused)) return;
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            output_request = OUTPUT_STOP;
+        }
+        wake_decoder();
     }
     
     void set_volume(int vol) {
-        volume.store(vol / 100.0f);
+        volume.store(volume_to_gain(vol), std::memory_order_relaxed);
     }
     
     bool is_track_playing() const {
@@ -197,12 +4044,145 @@ public:
     }
     
     bool is_track_finished() const {
-        return !is_playing && !current_url.empty() && !is_paused;
+        std::lock_guard<std::mutex> lock(state_mutex);
+        return !is_playing && !loading && !current_url.empty() && !is_paused;
+    }
+
+    std::vector<std::string> diagnostics_report() const {
+        return diagnostics.callbacks.load(std::memory_order_relaxed) ? diagnostics.report() : std::vector<std::string>{};
+    }
+
+    unsigned cache_hits() const { return cache.hit_count(); }
+    unsigned cache_misses() const { return cache.miss_count(); }
+    
+    // Starts fetching the head of a track the user looks likely to play;
+    // empty cancels. Tracks already held in full are left alone.
+    void speculate(const std::string& url) {
+        if (!url.empty() && prefetcher.state(url) != Prefetcher::NONE) return;
+        heads.want(url);
+    }
+
+    Prefetcher::State prefetch_state(const std::string& url) {
+        return prefetcher.state(url);
+    }
+    
+    bool is_loading() const {
+        return loading;
     }
     
-    const std::string& get_current_url() const {
+    std::string get_current_url() const {
+        std::lock_guard<std::mutex> lock(state_mutex);
         return current_url;
     }
+    
+    bool is_buffering() const {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        return is_playing && stream && stream->is_stalled();
+    }
+    
+    unsigned stream_stalls() const {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        return stream ? stream->stall_count() : 0;
+    }
+    
+    // Position in the audible track, from how far the device has read into
+    // the ring. Accurate to one device period.
+    double elapsed_seconds() {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        settle_boundaries();
+        ma_uint32 channels = output_channels, rate = output_rate;
+        if (current_url.empty() || !channels || !rate) return 0.0;
+        uint64_t read = ring.read_count();
+        uint64_t played = read > audible_start_sample ? (read - audible_start_sample) / channels : 0;
+        return double(audible_start_frame + played) / rate;
+    }
+
+    // 0 when the length is not known (a streamed MP3 without a Xing header).
+    double length_seconds() const {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        ma_uint32 rate = output_rate;
+        if (current_url.empty() || !audible_length || !rate) return 0.0;
+        return double(audible_length->load()) / rate;
+    }
+
+    // Jumps within the audible track. Refused while a load is in flight or
+    // in the last moments of a track whose successor is already decoding.
+    // Returns at once; the decode thread carries the seek out.
+    bool seek_to(double seconds) {
+        {
+            std::lock_guard<std::mutex> slock(state_mutex);
+            settle_boundaries();
+            if (decoding_url.empty() || !is_playing || loading || current_url != decoding_url || !boundaries.empty()) {
+                return false;
+            }
+            seek_target = std::max(seconds, 0.0);
+        }
+        wake_decoder();
+        return true;
+    }
+
+    // A transcode without a length cannot be seeked by byte offset, so a
+    // position outside what has arrived is requested from the server instead
+    // of decoded up to. The arrived range is estimated from the bytes the
+    // decoder has consumed so far.
+    bool needs_reopen(uint64_t frame) const {
+        const auto& s = current->stream;
+        if (!s || !is_universal(current->url) || s->is_complete() || s->length() >= 0) return false;
+        if (frame < current->frame_offset) return true;
+        ma_uint64 cursor = 0;
+        uint64_t consumed = s->bytes_read();
+        if (ma_decoder_get_cursor_in_pcm_frames(&current->decoder, &cursor) != MA_SUCCESS || !cursor || !consumed) {
+            return frame > current->frame_offset;
+        }
+        uint64_t arrived = current->frame_offset + s->bytes_received() * cursor / consumed;
+        return frame > arrived;
+    }
+
+    bool seek_by(double delta_seconds) {
+        return seek_to(elapsed_seconds() + delta_seconds);
+    }
+
+    // Effective real-time settings, empty when none were requested.
+    const std::string& realtime_report() const { return rt_report; }
+
+    void set_eq_preset(size_t index) {
+        std::lock_guard<std::mutex> lock(eq_mutex);
+        eq_index = index % settings.eq_presets.size();
+        publish_eq();
+    }
+
+    size_t current_eq_preset() const { return eq_index; }
+    size_t eq_preset_count() const { return settings.eq_presets.size(); }
+    const std::string& eq_preset_name(size_t index) const { return settings.eq_presets[index].name; }
+
+    // Takes effect once the loader re-opens the device.
+    void set_latency_profile(size_t index) {
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            requested_profile = index % LATENCY_PROFILE_COUNT;
+            profile_pending = true;
+        }
+        load_cv.notify_all();
+    }
+
+    size_t current_latency_profile() const {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        return profile_pending ? requested_profile : latency_profile.load();
+    }
+
+    // Output latency: the measured callback interval times the number of
+    // periods the backend granted.
+    double latency_ms() const {
+        return diagnostics.period_ns.load(std::memory_order_relaxed) * double(device_periods) / 1e6;
+    }
+
+    ma_uint32 output_sample_rate() const { return output_rate; }
+    ma_uint32 output_channel_count() const { return output_channels; }
+
+    uint64_t stream_bytes() const {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        return stream ? stream->bytes_received() : 0;
+    }
 };
 
 // ─────────────────────────────────────────────────────────────────────────────
@@ -211,6 +4191,7 @@ public:
 
 struct Track {
     std::string id, name, album, artist;
+    std::string container;      // source container as reported by the server, e.g. "flac"
 };
 
 struct Node {
@@ -239,7 +4220,8 @@ static size_t write_cb(void* contents, size_t sz, size_t nmemb, void* up) {
 
 json http_get_json(const std::string& url,
                    const std::map<std::string,std::string>& headers) {
-    CURL* curl = curl_easy_init();
+    auto http = http_client().acquire(HttpClient::API_TIMEOUT_MS);
+    CURL* curl = http.get();
     std::string resp;
     struct curl_slist* hdrs = nullptr;
     for (auto& [k,v]: headers)
@@ -248,17 +4230,16 @@ json http_get_json(const std::string& url,
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hdrs);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &resp);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-    curl_easy_perform(curl);
+    http.perform();
     curl_slist_free_all(hdrs);
-    curl_easy_cleanup(curl);
     return json::parse(resp);
 }
 
 json http_post_json(const std::string& url,
                     const json& payload,
                     const std::map<std::string,std::string>& headers) {
-    CURL* curl = curl_easy_init();
+    auto http = http_client().acquire(HttpClient::API_TIMEOUT_MS);
+    CURL* curl = http.get();
     std::string resp, body = payload.dump();
     struct curl_slist* hdrs = curl_slist_append(nullptr, "Content-Type: application/json");
     for (auto& [k,v] : headers)
@@ -268,10 +4249,8 @@ json http_post_json(const std::string& url,
     curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &resp);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-    curl_easy_perform(curl);
+    http.perform();
     curl_slist_free_all(hdrs);
-    curl_easy_cleanup(curl);
     return json::parse(resp);
 }
 
@@ -314,6 +4293,57 @@ json load_config(const std::string& path) {
     return j;
 }
 
+// Optional playback tuning; every key falls back to the PlayerSettings default.
+// "eq_presets": {"name": [{"type": "peak", "freq": 1000, "q": 1, "gain_db": 3}, ...]}
+// adds presets or replaces built-in ones of the same name.
+static void load_eq_presets(const json& cfg, std::vector<EqPreset>& presets) {
+    auto custom = cfg.find("eq_presets");
+    if (custom == cfg.end() || !custom->is_object()) return;
+    for (auto& [name, bands] : custom->items()) {
+        EqPreset preset{name, {}};
+        for (auto& b : bands) {
+            EqBand band;
+            std::string type = b.value("type", "peak");
+            band.type = type == "low_shelf" ? EqBand::LOW_SHELF : type == "high_shelf" ? EqBand::HIGH_SHELF : EqBand::PEAK;
+            band.freq = b.value("freq", band.freq);
+            band.q = b.value("q", band.q);
+            band.gain_db = b.value("gain_db", band.gain_db);
+            preset.bands.push_back(band);
+        }
+        auto same = std::find_if(presets.begin(), presets.end(), [&](const EqPreset& p) { return p.name == name; });
+        if (same != presets.end()) *same = std::move(preset);
+        else presets.push_back(std::move(preset));
+    }
+}
+
+PlayerSettings load_player_settings(const json& cfg) {
+    PlayerSettings s;
+    s.streaming           = cfg.value("streaming",           s.streaming);
+    s.stream_start_bytes  = cfg.value("stream_start_bytes",  s.stream_start_bytes);
+    s.stream_start_frames = cfg.value("stream_start_frames", s.stream_start_frames);
+    s.stream_buffer_bytes = std::max<size_t>(cfg.value("stream_buffer_bytes", s.stream_buffer_bytes),
+                                             s.stream_start_bytes * 2);
+    s.prefetch_count      = cfg.value("prefetch_count",      s.prefetch_count);
+    s.prefetch_max_bytes  = cfg.value("prefetch_max_bytes",  s.prefetch_max_bytes);
+    s.passthrough         = cfg.value("passthrough",         s.passthrough);
+    s.crossfade_seconds   = std::clamp(cfg.value("crossfade_seconds", s.crossfade_seconds), 0.0, 12.0);
+    s.normalize           = cfg.value("normalize",           s.normalize);
+    s.normalize_target_lufs = cfg.value("normalize_target_lufs", s.normalize_target_lufs);
+    s.loudness_threads    = cfg.value("loudness_threads",    s.loudness_threads);
+    s.rt_priority         = cfg.value("rt_priority",         s.rt_priority);
+    s.cpu_affinity        = cfg.value("cpu_affinity",        s.cpu_affinity);
+    s.lock_memory         = cfg.value("lock_memory",         s.lock_memory);
+    s.latency_profile     = LATENCY_PROFILES[latency_profile_index(cfg.value("latency_profile", s.latency_profile))].name;
+    s.speculative_delay_ms = cfg.value("speculative_delay_ms", s.speculative_delay_ms);
+    s.speculative_bytes   = cfg.value("speculative_bytes",   s.speculative_bytes);
+    s.speculative_max_rate = cfg.value("speculative_max_rate", s.speculative_max_rate);
+    load_eq_presets(cfg, s.eq_presets);
+    s.eq_preset           = cfg.value("eq_preset",           s.eq_preset);
+    s.cache_dir           = cfg.value("cache_dir",           s.cache_dir);
+    s.cache_max_bytes     = cfg.value("cache_max_bytes",     s.cache_max_bytes);
+    return s;
+}
+
 std::tuple<std::string,std::string,std::string>
 authenticate(const json& cfg) {
     auto base = cfg.at("server_url").get<std::string>();
@@ -344,38 +4374,326 @@ authenticate(const json& cfg) {
 // Fetch Tracks
 // ─────────────────────────────────────────────────────────────────────────────
 
+static constexpr int LIBRARY_PAGE_SIZE = 10000;
+static constexpr size_t LIBRARY_FETCH_WORKERS = 4;     // pages requested at once after the first
+
+// Everything a Track needs is in Jellyfin's base item fields, so no extra
+// Fields are asked for and images and user data are left out.
+static constexpr const char* LIBRARY_LEAN_QUERY = "&Fields=&EnableImages=false&EnableUserData=false";
+
+// Transfer and parse totals of a library fetch, for --bench-library.
+struct LibraryFetchStats {
+    uint64_t wire_bytes = 0;            // as received, before decompression
+    uint64_t body_bytes = 0;            // JSON handed to the parser
+    double parse_ms = 0;                // in the parser, not counting waits for data
+    double elapsed_ms = 0;
+
+    void add(const LibraryFetchStats& o) {
+        wire_bytes += o.wire_bytes;
+        body_bytes += o.body_bytes;
+        parse_ms += o.parse_ms;
+    }
+};
+
+struct TrackPage {
+    std::vector<Track> tracks;
+    int64_t total = -1;                 // TotalRecordCount, when the server sends it
+    LibraryFetchStats stats;
+};
+
+// The response of a running transfer as a stream buffer: the write callback
+// appends chunks on the I/O thread, the reader blocks until more arrive or
+// the transfer ends.
+class TransferStreamBuf : public std::streambuf {
+public:
+    size_t write(const char* data, size_t len) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (len) chunks.emplace_back(data, len);
+        received += len;
+        cv.notify_one();
+        return len;
+    }
+
+    void close(CURLcode res) {
+        std::lock_guard<std::mutex> lock(mtx);
+        result = res;
+        closed = true;
+        cv.notify_one();
+    }
+
+    // CURLE_OK until the transfer has ended.
+    CURLcode transfer_result() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return result;
+    }
+
+    uint64_t bytes_received() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return received;
+    }
+
+    // Time the reader has spent blocked on the transfer.
+    double waited_ms() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return waited_us / 1000.0;
+    }
+
+protected:
+    int_type underflow() override {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (chunks.empty() && !closed) {
+            auto t0 = std::chrono::steady_clock::now();
+            cv.wait(lock, [&]{ return !chunks.empty() || closed; });
+            waited_us += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+        }
+        if (chunks.empty()) return traits_type::eof();
+        current = std::move(chunks.front());
+        chunks.pop_front();
+        setg(current.data(), current.data(), current.data() + current.size());
+        return traits_type::to_int_type(current[0]);
+    }
+
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::string> chunks;
+    std::string current;                // the chunk the get area points into
+    CURLcode result = CURLE_OK;
+    bool closed = false;
+    uint64_t received = 0;
+    double waited_us = 0;
+};
+
+static size_t transfer_write_cb(void* contents, size_t sz, size_t nmemb, void* up) {
+    return static_cast<TransferStreamBuf*>(up)->write(static_cast<char*>(contents), sz * nmemb);
+}
+
+// Builds Tracks from the SAX events of an Items page as they are parsed.
+// Only the fields a Track keeps are copied; everything else is skipped.
+class TrackPageParser : public json::json_sax_t {
+public:
+    TrackPage page;
+    std::string error;
+
+    bool null() override { return true; }
+    bool boolean(bool) override { return true; }
+    bool number_integer(number_integer_t v) override { return count(v); }
+    bool number_unsigned(number_unsigned_t v) override { return count(static_cast<int64_t>(v)); }
+    bool number_float(number_float_t, const string_t&) override { return true; }
+    bool binary(binary_t&) override { return true; }
+
+    bool string(string_t& v) override {
+        if (depth == ITEM && in_items && field) *field = std::move(v);
+        else if (depth == ARTIST && in_first_artist && artist_name) first_artist = std::move(v);
+        return true;
+    }
+
+    bool key(string_t& k) override {
+        if (depth == ROOT) {
+            root_key = k;
+        } else if (depth == ITEM && in_items) {
+            field = k == "Id" ? &track.id : k == "Name" ? &track.name : k == "Album" ? &track.album
+                  : k == "AlbumArtist" ? &album_artist : k == "Container" ? &track.container : nullptr;
+            artists_key = k == "Artists";
+        } else if (depth == ARTIST && in_first_artist) {
+            artist_name = k == "Name";
+        }
+        return true;
+    }
+
+    bool start_object(std::size_t) override {
+        ++depth;
+        if (depth == ITEM && in_items) {
+            track = {"", "Unknown", "Unknown", "", ""};
+            album_artist.clear();
+            first_artist = "Unknown";
+            artist_seen = false;
+            field = nullptr;
+            artists_key = false;
+        } else if (depth == ARTIST && in_artists && !artist_seen) {
+            in_first_artist = true;
+            artist_name = false;
+        }
+        return true;
+    }
+
+    bool end_object() override {
+        if (depth == ITEM && in_items) {
+            track.artist = album_artist.empty() ? std::move(first_artist) : std::move(album_artist);
+            page.tracks.push_back(std::move(track));
+        } else if (depth == ARTIST && in_first_artist) {
+            in_first_artist = false;
+            artist_seen = true;
+        }
+        --depth;
+        return true;
+    }
+
+    bool start_array(std::size_t) override {
+        ++depth;
+        if (depth == ITEMS && root_key == "Items") in_items = true;
+        else if (depth == ARTISTS && in_items && artists_key) in_artists = true;
+        return true;
+    }
+
+    bool end_array() override {
+        if (depth == ITEMS) in_items = false;
+        else if (depth == ARTISTS) in_artists = false;
+        --depth;
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string&, const json::exception& e) override {
+        error = e.what();
+        return false;
+    }
+
+private:
+    // Nesting depth of each level we read: {"Items": [{"Artists": [{...}]}]}
+    enum { ROOT = 1, ITEMS, ITEM, ARTISTS, ARTIST };
+
+    int depth = 0;
+    std::string root_key;
+    bool in_items = false, in_artists = false, in_first_artist = false;
+    Track track;
+    std::string album_artist, first_artist;
+    std::string* field = nullptr;       // where the current item key's string goes
+    bool artists_key = false, artist_seen = false, artist_name = false;
+
+    bool count(int64_t v) {
+        if (depth == ROOT && root_key == "TotalRecordCount") page.total = v;
+        return true;
+    }
+};
+
+// One page of the library, parsed as the bytes come in; neither the response
+// nor a DOM of it is ever held whole. `compressed` offers every encoding this
+// libcurl can decode (gzip, brotli, zstd as built).
+static TrackPage fetch_track_page(const std::string& url, const std::string& token, bool compressed) {
+    // Declared before the lease, so both outlive a transfer that the lease
+    // cancels on the way out.
+    TransferStreamBuf body;
+    std::unique_ptr<curl_slist, decltype(&curl_slist_free_all)> hdrs(
+        curl_slist_append(nullptr, ("X-Emby-Token: " + token).c_str()), curl_slist_free_all);
+    auto http = http_client().acquire(HttpClient::API_TIMEOUT_MS);
+    CURL* curl = http.get();
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hdrs.get());
+    if (compressed) curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, transfer_write_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+    http.start([&body](CURLcode res) { body.close(res); });
+
+    std::istream in(&body);
+    TrackPageParser parser;
+    auto t0 = std::chrono::steady_clock::now();
+    bool parsed = json::sax_parse(in, &parser);
+    double parse_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    CURLcode res = body.transfer_result();
+    if (res != CURLE_OK) throw std::runtime_error(std::string("Library request failed: ") + curl_easy_strerror(res));
+    if (!parsed) throw std::runtime_error("Bad library page: " + parser.error);
+
+    // Complete once the parser has seen the end of the body.
+    curl_off_t wire = 0;
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &wire);
+    parser.page.stats.wire_bytes = wire;
+    parser.page.stats.body_bytes = body.bytes_received();
+    parser.page.stats.parse_ms = std::max(0.0, parse_ms - body.waited_ms());
+    return std::move(parser.page);
+}
+
+// The first page reports TotalRecordCount; the rest are then requested by a
+// few workers at once, each parsing what it fetched, and merged in order.
+// Servers that leave the count out are walked one page at a time. `lean`
+// trims and compresses the pages; without it the query is the full one,
+// kept for --bench-library to compare against.
 std::vector<Track> fetch_tracks(const std::string& base,
                                 const std::string& token,
-                                const std::string& user_id) {
-    std::vector<Track> out;
-    int start = 0, limit = 10000;
-    auto hdrs = std::map<std::string,std::string>{{"X-Emby-Token", token}};
-    while (true) {
-        auto r = http_get_json(
+                                const std::string& user_id,
+                                bool lean = true,
+                                LibraryFetchStats* stats = nullptr) {
+    auto started = std::chrono::steady_clock::now();
+    std::mutex stats_mtx;
+    auto request = [&](size_t index) {
+        TrackPage page = fetch_track_page(
           base + "/Users/" + user_id +
           "/Items?IncludeItemTypes=Audio&Recursive=true"
           "&SortBy=Album,SortName&SortOrder=Ascending"
-          "&StartIndex=" + std::to_string(start) +
-          "&Limit=" + std::to_string(limit),
-          hdrs
+          "&StartIndex=" + std::to_string(index * LIBRARY_PAGE_SIZE) +
+          "&Limit=" + std::to_string(LIBRARY_PAGE_SIZE) +
+          (lean ? LIBRARY_LEAN_QUERY : ""),
+          token, lean
         );
-        auto items = r.value("Items", json::array());
-        if (items.empty()) break;
-        for (auto& it : items) {
-            out.push_back({
-                it.value("Id",""),
-                it.value("Name","Unknown"),
-                it.value("Album","Unknown"),
-                !it.value("AlbumArtist","").empty()
-                  ? it.value("AlbumArtist","")
-                  : (!it.value("Artists",json::array()).empty()
-                     ? it["Artists"][0].value("Name","Unknown")
-                     : std::string("Unknown"))
-            });
+        if (stats) {
+            std::lock_guard<std::mutex> lock(stats_mtx);
+            stats->add(page.stats);
+        }
+        return page;
+    };
+    auto page = [&](size_t index) {
+        return request(index).tracks;
+    };
+
+    auto first = request(0);
+    std::vector<std::vector<Track>> pages;
+    pages.push_back(std::move(first.tracks));
+    int64_t total = first.total;
+
+    if (total < 0) {
+        while (pages.back().size() == static_cast<size_t>(LIBRARY_PAGE_SIZE)) {
+            pages.push_back(page(pages.size()));
+        }
+    } else if (total > LIBRARY_PAGE_SIZE) {
+        size_t count = (static_cast<size_t>(total) + LIBRARY_PAGE_SIZE - 1) / LIBRARY_PAGE_SIZE;
+        pages.resize(count);
+        std::atomic<size_t> next{1};
+        std::mutex mtx;
+        std::condition_variable cv;
+        size_t loaded = pages[0].size(), running = std::min(LIBRARY_FETCH_WORKERS, count - 1);
+        std::exception_ptr error;
+
+        auto worker = [&] {
+            for (size_t i; (i = next++) < count;) {
+                std::vector<Track> tracks;
+                std::exception_ptr failed;
+                try {
+                    tracks = page(i);
+                } catch (...) {
+                    failed = std::current_exception();
+                }
+                std::lock_guard<std::mutex> lock(mtx);
+                if (failed && !error) error = failed;
+                loaded += tracks.size();
+                pages[i] = std::move(tracks);
+                cv.notify_one();
+            }
+            std::lock_guard<std::mutex> lock(mtx);
+            --running;
+            cv.notify_one();
+        };
+        std::vector<std::thread> workers;
+        for (size_t n = running; n > 0; --n) workers.emplace_back(worker);
+
+        std::unique_lock<std::mutex> lock(mtx);
+        for (size_t shown = 0; ; cv.wait(lock)) {
+            if (loaded != shown) {
+                shown = loaded;
+                std::cout << "\r  " << shown << " / " << total << " tracks" << std::flush;
+            }
+            if (!running) break;
         }
-        if ((int)items.size() < limit) break;
-        start += limit;
+        lock.unlock();
+        std::cout << std::endl;
+        for (auto& w : workers) w.join();
+        if (error) std::rethrow_exception(error);
     }
+
+    std::vector<Track> out;
+    size_t n = 0;
+    for (auto& p : pages) n += p.size();
+    out.reserve(n);
+    for (auto& p : pages) std::move(p.begin(), p.end(), std::back_inserter(out));
+    if (stats) stats->elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
     return out;
 }
 
@@ -409,16 +4727,179 @@ std::unique_ptr<Node> build_tree(const std::vector<Track>& tracks) {
     return root;
 }
 
+// ─────────────────────────────────────────────────────────────────────────────
+// Stream URLs: direct play for what miniaudio decodes, MP3 transcode otherwise
+// ─────────────────────────────────────────────────────────────────────────────
+
+static const char* const DIRECT_PLAY_CONTAINERS[] = { "mp3", "flac", "wav" };
+
+// The container to request as-is, or "" when the server has to transcode.
+// Jellyfin reports some containers as a list ("mov,mp4,m4a").
+std::string direct_play_container(const Track& t) {
+    std::stringstream names(t.container);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+        for (const char* c : DIRECT_PLAY_CONTAINERS) {
+            if (name == c) return name;
+        }
+    }
+    return "";
+}
+
+std::string stream_url(const std::string& base, const std::string& token, const Track& t) {
+    std::string direct = direct_play_container(t);
+    if (!direct.empty()) {
+        return base + "/Audio/" + t.id + "/stream." + direct + "?static=true&api_key=" + token;
+    }
+    if (t.container.empty()) {
+        // Unknown source: let the server direct-stream anything we can decode.
+        return base + "/Audio/" + t.id + "/universal?Container=mp3,flac,wav"
+               "&TranscodingContainer=mp3&AudioCodec=mp3&api_key=" + token;
+    }
+    return base + "/Audio/" + t.id + "/universal?AudioCodec=mp3&Container=mp3&api_key=" + token;
+}
+
+std::string playback_path(const Track& t) {
+    std::string direct = direct_play_container(t);
+    if (!direct.empty()) return "Direct: " + direct;
+    if (t.container.empty()) return "Server decides";
+    return "Transcode: " + t.container + " -> mp3";
+}
+
 // ─────────────────────────────────────────────────────────────────────────────
 // UI Loop with Queuing, Focus & Auto-Advance,
-// Play/Pause, Volume (PgUp/Dn), Shuffle (⤨)
+// Play/Pause, Volume (PgUp/Dn), Seek (, .), Shuffle (⤨)
 // ─────────────────────────────────────────────────────────────────────────────
 
 enum Focus { TREE_FOCUSED, QUEUE_FOCUSED };
 
+static constexpr double SEEK_STEP_SECONDS = 10.0;
+
+// Fetches the library with the full query and then the lean one and prints
+// what each cost.
+int bench_library(const std::string& base, const std::string& token, const std::string& user_id) {
+    char line[96];
+    std::vector<std::string> lines;
+    snprintf(line, sizeof(line), "%-6s %8s %12s %12s %10s %10s", "query", "tracks", "wire bytes", "json bytes", "parse ms", "total ms");
+    lines.push_back(line);
+    for (bool lean : {false, true}) {
+        LibraryFetchStats stats;
+        size_t tracks = fetch_tracks(base, token, user_id, lean, &stats).size();
+        snprintf(line, sizeof(line), "%-6s %8zu %12llu %12llu %10.1f %10.1f", lean ? "lean" : "full", tracks,
+                 static_cast<unsigned long long>(stats.wire_bytes), static_cast<unsigned long long>(stats.body_bytes),
+                 stats.parse_ms, stats.elapsed_ms);
+        lines.push_back(line);
+    }
+    for (const auto& l : lines) std::cout << l << std::endl;
+    return 0;
+}
+
+// Checks the signal path against known answers without a server, for
+// --self-test. Returns nonzero if any check fails.
+int self_test() {
+    const double pi = 3.14159265358979323846;
+    const ma_uint32 rate = 48000;
+    int failures = 0;
+    auto report = [&](bool ok, const char* what) {
+        std::cout << (ok ? "PASS  " : "FAIL  ") << what << std::endl;
+        if (!ok) ++failures;
+    };
+    char line[128];
+
+    // EQ: the steady-state gain of sine tones through EqStage against the
+    // cascade's analytic response, taken from the float coefficients it runs.
+    auto presets = builtin_eq_presets();
+    presets.push_back({"eight-band", {{EqBand::LOW_SHELF, 100, 0.7, 6}, {EqBand::PEAK, 300, 1.0, -4},
+                                      {EqBand::PEAK, 1000, 1.4, 3}, {EqBand::PEAK, 2000, 1.0, 2},
+                                      {EqBand::PEAK, 3000, 2.0, -2}, {EqBand::HIGH_SHELF, 8000, 0.7, 4},
+                                      {EqBand::PEAK, 12000, 1.0, 2}, {EqBand::PEAK, 16000, 2.0, -3}}});
+    for (const EqPreset& preset : presets) {
+        auto eq = compile_eq(preset, rate);
+        auto response = [&](double w) {
+            double m = 1.0;
+            for (size_t g = 0; g < eq->group_count; ++g) {
+                const EqCoefficients::Group& c = eq->groups[g];
+                for (size_t lane = 0; lane < EQ_LANES; ++lane) {
+                    const double q[6] = {c.b0[lane], c.b1[lane], c.b2[lane], 1.0, c.a1[lane], c.a2[lane]};
+                    m *= quadratic_magnitude(q, w) / quadratic_magnitude(q + 3, w);
+                }
+            }
+            return m;
+        };
+        double peak = 0.0;
+        for (int k = 0; k <= 20000; ++k) peak = std::max(peak, response(2 * pi * std::pow(0.5 * rate, k / 20000.0) / rate));
+
+        for (ma_uint32 channels : {1u, 2u, 3u}) {
+            // One second per tone, measured over the last half: a whole
+            // number of periods at every test frequency.
+            const size_t frames = rate;
+            const float amp = 0.25f;
+            double worst = 0.0;
+            std::vector<float> buf(frames * channels);
+            for (double freq : {50.0, 440.0, 1000.0, 3000.0, 9000.0, 15000.0}) {
+                for (size_t f = 0; f < frames; ++f)
+                    for (ma_uint32 c = 0; c < channels; ++c)
+                        buf[f * channels + c] = amp * float(std::sin(2 * pi * freq * f / rate + c));
+                EqStage stage;
+                stage.publish(eq.get());
+                for (size_t f = 0; f < frames; f += 480)
+                    stage.process(buf.data() + f * channels, std::min<size_t>(480, frames - f), channels, rate);
+                double expected = response(2 * pi * freq / rate);
+                for (ma_uint32 c = 0; c < channels; ++c) {
+                    double energy = 0.0;
+                    for (size_t f = frames / 2; f < frames; ++f) energy += double(buf[f * channels + c]) * buf[f * channels + c];
+                    double gain = std::sqrt(energy / (frames / 2)) / (amp / std::sqrt(2.0));
+                    worst = std::max(worst, std::fabs(20 * std::log10(gain / expected)));
+                }
+            }
+            snprintf(line, sizeof(line), "eq %-10s %u ch: error %.4f dB, peak %+.4f dB", preset.name.c_str(),
+                     channels, worst, 20 * std::log10(peak));
+            report(worst < 0.001 && peak < 1.0001, line);
+        }
+    }
+
+    // Loudness: a 997 Hz tone at -23 dBFS in both stereo channels reads
+    // -23 LUFS (EBU Tech 3341, case 1). The same tone on all four channels of
+    // 4.0, none of them surrounds, doubles the power: +3.01 dB.
+    auto tone_lufs = [&](unsigned channels) {
+        LoudnessMeter meter(channels, rate);
+        const float amp = float(std::pow(10.0, -23.0 / 20.0));
+        std::vector<float> buf(size_t(rate) * channels);
+        size_t t = 0;
+        for (int second = 0; second < 20; ++second) {
+            for (size_t f = 0; f < rate; ++f, ++t)
+                for (unsigned c = 0; c < channels; ++c) buf[f * channels + c] = amp * float(std::sin(2 * pi * 997.0 * t / rate));
+            meter.add(buf.data(), rate);
+        }
+        return meter.integrated();
+    };
+    double stereo = tone_lufs(2), quad = tone_lufs(4);
+    snprintf(line, sizeof(line), "loudness 997 Hz stereo: %.2f LUFS, expected -23.00", stereo);
+    report(std::fabs(stereo + 23.0) < 0.005, line);
+    snprintf(line, sizeof(line), "loudness 997 Hz 4.0: %+.2f dB over stereo, expected +3.01", quad - stereo);
+    report(std::fabs(quad - stereo - 10 * std::log10(2.0)) < 0.005, line);
+
+    std::cout << (failures ? "Self-test failed." : "Self-test passed.") << std::endl;
+    return failures ? 1 : 0;
+}
+
+void print_diagnostics(const AudioPlayer& player) {
+    auto diagnostics = player.diagnostics_report();
+    if (!diagnostics.empty()) {
+        std::cout << "Audio diagnostics:" << std::endl;
+        for (const auto& line : diagnostics) std::cout << "  " << line << std::endl;
+    }
+    auto network = http_client().report();
+    if (!network.empty()) {
+        std::cout << "Network:" << std::endl;
+        for (const auto& line : network) std::cout << "  " << line << std::endl;
+    }
+}
+
 void ui_loop(Node* root,
              const std::string& base,
-             const std::string& token) {
+             const std::string& token,
+             const PlayerSettings& settings) {
     setlocale(LC_ALL, "");
     initscr();
 
@@ -435,7 +4916,8 @@ void ui_loop(Node* root,
     cbreak();
     noecho();
     keypad(stdscr, TRUE);
-    halfdelay(10);
+    int tick = 2;   // getch() timeout in tenths of a second, see below
+    halfdelay(tick);
 
     int rows, cols; getmaxyx(stdscr, rows, cols);
     int ctrl_h   = 1;
@@ -457,12 +4939,44 @@ void ui_loop(Node* root,
 
     int  volume = 50;
     bool paused = false;
+    bool show_diagnostics = false;
+    Node* rest_node = nullptr;      // tree row the cursor is resting on
+    auto rest_since = std::chrono::steady_clock::now();
+    bool speculated = false;
 
     std::random_device rd;
     std::mt19937 rng(rd());
 
-    std::unique_ptr<AudioPlayer> player = std::make_unique<AudioPlayer>();
+    std::unique_ptr<AudioPlayer> player = std::make_unique<AudioPlayer>(settings);
+    player->set_volume(volume);
     Node* playing_node = nullptr;
+    Node* loading_node = nullptr;   // requested but not yet started
+    std::string status_msg = player->realtime_report().empty() ? "" : "RT: " + player->realtime_report();
+    std::vector<std::string> sent_upcoming;
+
+    auto track_url = [&](Node* n) {
+        return stream_url(base, token, *n->track);
+    };
+
+    auto queued_index = [&](const std::string& url) -> size_t {
+        for (size_t i = 0; i < queueList.size(); ++i)
+            if (track_url(queueList[i]) == url) return i;
+        return queueList.size();
+    };
+
+    // Hand the engine everything that should follow the playing track so it
+    // can pre-roll and splice without a gap.
+    auto sync_upcoming = [&]() {
+        std::vector<std::string> urls;
+        for (size_t i = 0; i < queueList.size(); ++i) {
+            if (i == 0 && queueList[0] == playing_node) continue;
+            urls.push_back(track_url(queueList[i]));
+        }
+        if (urls != sent_upcoming) {
+            player->set_upcoming(urls);
+            sent_upcoming = std::move(urls);
+        }
+    };
 
     auto draw_ui = [&]() {
         visible.clear();
@@ -513,10 +5027,45 @@ void ui_loop(Node* root,
                       cur->depth==1?"Albums":"Tracks",
                       (int)cur->children.size());
         }
-        if (playing_node) {
+        if (loading_node) {
+            mvwprintw(info_win,iy++,1,"Loading: %s", loading_node->name.c_str());
+        } else if (!status_msg.empty()) {
+            mvwprintw(info_win,iy++,1,"%s", status_msg.c_str());
+        }
+        if (show_diagnostics) {
+            mvwprintw(info_win,iy+1,1,"Diagnostics:");
+            int dy = iy + 2;
+            for (const auto& line : player->diagnostics_report()) {
+                mvwprintw(info_win,dy++,1,"%s", line.c_str());
+            }
+        } else if (playing_node) {
             mvwprintw(info_win,iy+1,1,"Now Playing:");
             mvwprintw(info_win,iy+2,1,"%s", playing_node->name.c_str());
+            mvwprintw(info_win,iy+3,1,"%s", playback_path(*playing_node->track).c_str());
+            int elapsed = static_cast<int>(player->elapsed_seconds());
+            int length  = static_cast<int>(player->length_seconds());
+            if (length > 0) {
+                mvwprintw(info_win,iy+4,1,"%d:%02d / %d:%02d", elapsed/60, elapsed%60, length/60, length%60);
+            } else {
+                mvwprintw(info_win,iy+4,1,"%d:%02d", elapsed/60, elapsed%60);
+            }
+            if (player->is_buffering()) {
+                mvwprintw(info_win,iy+5,1,"Buffering... %llu KB",
+                          (unsigned long long)(player->stream_bytes() / 1024));
+            }
+            if (player->stream_stalls() > 0) {
+                mvwprintw(info_win,iy+6,1,"Stalls: %u", player->stream_stalls());
+            }
+        }
+        if (playing_node) {
+            mvwprintw(info_win,info_h-5,1,"EQ: %s", player->eq_preset_name(player->current_eq_preset()).c_str());
+            mvwprintw(info_win,info_h-4,1,"Latency: %.0f ms (%s)", player->latency_ms(),
+                      LATENCY_PROFILES[player->current_latency_profile()].name);
+            mvwprintw(info_win,info_h-3,1,"Output: %u Hz, %u ch",
+                      player->output_sample_rate(), player->output_channel_count());
         }
+        mvwprintw(info_win,info_h-2,1,"Cache: %u hits / %u misses",
+                  player->cache_hits(), player->cache_misses());
         wnoutrefresh(info_win);
 
         // QUEUE PANEL
@@ -528,8 +5077,10 @@ void ui_loop(Node* root,
         mvwprintw(queue_win,0,2," Queue ");
         int qy = 1, qlines = queue_h - 2;
         for (size_t i = queue_top; i < queueList.size() && qy < queue_h-1; ++i, ++qy) {
+            auto pf = player->prefetch_state(track_url(queueList[i]));
+            const char* mark = pf==Prefetcher::READY ? "*" : pf==Prefetcher::FETCHING ? "~" : " ";
             if (focus==QUEUE_FOCUSED && i==queueCursor) wattron(queue_win, A_REVERSE);
-            mvwprintw(queue_win, qy, 1, "%s", queueList[i]->name.c_str());
+            mvwprintw(queue_win, qy, 1, "%s %s", mark, queueList[i]->name.c_str());
             if (focus==QUEUE_FOCUSED && i==queueCursor) wattroff(queue_win, A_REVERSE);
         }
         wnoutrefresh(queue_win);
@@ -540,7 +5091,7 @@ void ui_loop(Node* root,
         wattron(controls_win, has_colors() ? COLOR_PAIR(2) : A_REVERSE);
         const char* status_icon = paused ? "⏸" : " ▶";
         mvwprintw(controls_win, 0, 1,
-                   "%s 🕪 %d%%  Nav: ↑ → ↓ ← ❘ Play: ⏎ ❘ ▶/⏸ : spcbar ❘ Vol: PgUp/Dn ❘ Add/Rm: F ❘⤨ : S ❘ Quit: Q",
+                   "%s 🕪 %d%%  Nav: ↑ → ↓ ← ❘ Play: ⏎ ❘ ▶/⏸ : spcbar ❘ Vol: PgUp/Dn ❘ Seek: , . ❘ EQ: E ❘ Latency: L ❘ Diag: D ❘ Add/Rm: F ❘⤨ : S ❘ Quit: Q",
                    status_icon, volume);
         wattroff(controls_win, has_colors() ? COLOR_PAIR(2) : A_REVERSE);
         wnoutrefresh(controls_win);
@@ -553,6 +5104,15 @@ void ui_loop(Node* root,
     int data_lines = main_h - 2;
     int ch;
     while (true) {
+        // Five redraws a second pick up load completions and the cursor-rest
+        // timer promptly; with nothing pending, once a second keeps the clock.
+        bool rest_pending = !speculated && rest_node && rest_node->track && rest_node != playing_node
+                            && rest_node != loading_node && settings.speculative_delay_ms > 0;
+        int want = loading_node || player->is_loading() || player->is_buffering() || rest_pending ? 2 : 10;
+        if (want != tick) {
+            tick = want;
+            halfdelay(tick);
+        }
         ch = getch();
         bool handled = false;
 
@@ -571,7 +5131,7 @@ void ui_loop(Node* root,
         else if (ch == 27) {
             nodelay(stdscr, TRUE);
             int s1=getch(),s2=getch(),s3=getch(),s4=getch(),s5=getch();
-            nodelay(stdscr, FALSE);
+            halfdelay(tick);    // nodelay(FALSE) would leave getch() blocking
             if (s1=='[' && s2=='1' && s3==';' && s4=='5' && (s5=='A'||s5=='B')) {
                 if (s5=='A') volume = std::min(100,volume+5);
                 else          volume = std::max(0,volume-5);
@@ -597,6 +5157,21 @@ void ui_loop(Node* root,
                     player->resume();
                 }
             }
+            else if (ch==',' || ch=='<') {
+                player->seek_by(-SEEK_STEP_SECONDS);
+            }
+            else if (ch=='.' || ch=='>') {
+                player->seek_by(SEEK_STEP_SECONDS);
+            }
+            else if (ch=='E'||ch=='e') {
+                player->set_eq_preset(player->current_eq_preset() + 1);
+            }
+            else if (ch=='L'||ch=='l') {
+                player->set_latency_profile(player->current_latency_profile() + 1);
+            }
+            else if (ch=='D'||ch=='d') {
+                show_diagnostics = !show_diagnostics;
+            }
             else if (ch=='\t') {
                 focus = (focus==TREE_FOCUSED ? QUEUE_FOCUSED : TREE_FOCUSED);
             }
@@ -627,12 +5202,8 @@ void ui_loop(Node* root,
                     break;
                   case '\n':
                     if(cur->track){
-                      std::string url=base+"/Audio/"+cur->track->id
-                        +"/universal?AudioCodec=mp3&Container=mp3&api_key="+token;
-                      if (player->play(url)) {
-                          paused = false;
-                          playing_node = cur;
-                      }
+                      player->play(track_url(cur));
+                      loading_node = cur;
                     }
                     break;
                 }
@@ -643,19 +5214,45 @@ void ui_loop(Node* root,
                   case '\n':
                     if(!queueList.empty()){
                       Node* cur=queueList[queueCursor];
-                      std::string url=base+"/Audio/"+cur->track->id
-                        +"/universal?AudioCodec=mp3&Container=mp3&api_key="+token;
-                      if (player->play(url)) {
-                          paused = false;
-                          playing_node = cur;
-                      }
+                      player->play(track_url(cur));
+                      loading_node = cur;
                     }
                     break;
                 }
             }
         }
 
-        // auto-advance
+        // player events
+        PlayerEvent ev;
+        while (player->poll_event(ev)) {
+            if (ev.type == PlayerEvent::STARTED) {
+                paused = false;
+                playing_node = loading_node;
+                loading_node = nullptr;
+                status_msg.clear();
+            } else if (ev.type == PlayerEvent::ADVANCED) {
+                // the engine moved on to the next queued track by itself
+                if(!queueList.empty() && queueList.front()==playing_node){
+                    queueList.erase(queueList.begin());
+                    if(queueCursor>0) --queueCursor;
+                }
+                size_t qi = queued_index(ev.url);
+                playing_node = qi < queueList.size() ? queueList[qi] : nullptr;
+            } else if (loading_node && track_url(loading_node) == ev.url) {
+                status_msg = "Failed to load: " + loading_node->name;
+                loading_node = nullptr;
+            } else {
+                // a queued track the engine could not open; drop it
+                size_t qi = queued_index(ev.url);
+                if (qi < queueList.size()) {
+                    status_msg = "Failed to load: " + queueList[qi]->name;
+                    queueList.erase(queueList.begin()+qi);
+                    if(queueCursor>0 && queueCursor>=qi) --queueCursor;
+                }
+            }
+        }
+
+        // auto-advance, for when the engine ran out of queued tracks
         if (player->is_track_finished()) {
             if(!queueList.empty() && queueList.front()==playing_node){
                 queueList.erase(queueList.begin());
@@ -663,14 +5260,26 @@ void ui_loop(Node* root,
             }
             if(!queueList.empty()){
                 Node* next=queueList.front();
-                std::string url=base+"/Audio/"+next->track->id
-                  +"/universal?AudioCodec=mp3&Container=mp3&api_key="+token;
-                if (player->play(url)) {
-                    paused = false;
-                    playing_node = next;
-                }
+                player->play(track_url(next));
+                loading_node = next;
             }
         }
+        sync_upcoming();
+
+        // A track the cursor rests on is likely to be played next; fetch its
+        // head so Enter starts without waiting for the network.
+        Node* under = focus==TREE_FOCUSED ? visible[cursor] : nullptr;
+        if (under != rest_node) {
+            if (speculated) player->speculate("");
+            rest_node = under;
+            rest_since = std::chrono::steady_clock::now();
+            speculated = false;
+        } else if (!speculated && under && under->track && under != playing_node && under != loading_node
+                   && settings.speculative_delay_ms > 0
+                   && std::chrono::steady_clock::now() - rest_since >= std::chrono::milliseconds(settings.speculative_delay_ms)) {
+            player->speculate(track_url(under));
+            speculated = true;
+        }
 
         // scroll
         if(focus==TREE_FOCUSED){
@@ -687,18 +5296,456 @@ void ui_loop(Node* root,
     }
 
     endwin();
+    print_diagnostics(*player);
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Headless daemon: line commands on a Unix socket, no curses
+// ─────────────────────────────────────────────────────────────────────────────
+
+// Refreshed whenever the daemon wakes up, so a status query is answered
+// from here without touching the player's locks.
+struct DaemonStatus {
+    const char* state = "stopped";      // playing, paused, loading or stopped
+    Node* track = nullptr;
+    double elapsed = 0.0;
+    double length = 0.0;
+    std::chrono::steady_clock::time_point taken;
+    int volume = 50;
+    size_t queued = 0;
+    std::string error;                  // last track that failed to load
+};
+
+struct ControlClient {
+    int fd;
+    std::string in, out;
+    bool closing = false;
+};
+
+// O_NONBLOCK and FD_CLOEXEC through fcntl, since macOS has neither
+// SOCK_NONBLOCK nor accept4().
+static bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0 && fcntl(fd, F_SETFD, FD_CLOEXEC) == 0;
+}
+
+// Closes a descriptor on every way out of daemon_loop().
+struct ScopedFd {
+    int fd;
+    explicit ScopedFd(int fd) : fd(fd) {}
+    ScopedFd(const ScopedFd&) = delete;
+    ScopedFd& operator=(const ScopedFd&) = delete;
+    ~ScopedFd() { if (fd >= 0) ::close(fd); }
+};
+
+// Blocks signals for as long as it lives, then puts the old mask back.
+struct ScopedSignalMask {
+    sigset_t previous;
+    explicit ScopedSignalMask(const sigset_t& blocked) { pthread_sigmask(SIG_BLOCK, &blocked, &previous); }
+    ScopedSignalMask(const ScopedSignalMask&) = delete;
+    ScopedSignalMask& operator=(const ScopedSignalMask&) = delete;
+    ~ScopedSignalMask() { pthread_sigmask(SIG_SETMASK, &previous, nullptr); }
+};
+
+// Turns SIGINT and SIGTERM into a byte on a pipe that poll() can watch, for
+// as long as it lives, then puts the old handlers back. A self-pipe rather
+// than signalfd, which only Linux has.
+class SignalPipe {
+public:
+    SignalPipe() {
+        if (pipe(fds) != 0) return;
+        for (int fd : fds) set_nonblocking(fd);
+        write_fd = fds[1];
+        sigemptyset(&handled);
+        sigaddset(&handled, SIGINT);
+        sigaddset(&handled, SIGTERM);
+        struct sigaction sa{};
+        sa.sa_handler = on_signal;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESTART;
+        sigaction(SIGINT, &sa, &previous[0]);
+        sigaction(SIGTERM, &sa, &previous[1]);
+    }
+    SignalPipe(const SignalPipe&) = delete;
+    SignalPipe& operator=(const SignalPipe&) = delete;
+    ~SignalPipe() {
+        if (fds[0] < 0) return;
+        sigaction(SIGINT, &previous[0], nullptr);
+        sigaction(SIGTERM, &previous[1], nullptr);
+        write_fd = -1;
+        ::close(fds[0]);
+        ::close(fds[1]);
+    }
+
+    int fd() const { return fds[0]; }
+    const sigset_t& signals() const { return handled; }
+
+    // Drains the pipe; true if a signal came in.
+    bool take() {
+        char buf[16];
+        bool got = false;
+        while (read(fds[0], buf, sizeof(buf)) > 0) got = true;
+        return got;
+    }
+
+private:
+    static inline volatile sig_atomic_t write_fd = -1;
+    int fds[2] = {-1, -1};
+    sigset_t handled;
+    struct sigaction previous[2];
+
+    static void on_signal(int) {
+        int saved = errno;
+        char c = 1;
+        if (write_fd >= 0) {
+            ssize_t n = write(write_fd, &c, 1);     // a full pipe already says enough
+            (void)n;
+        }
+        errno = saved;
+    }
+};
+
+#if defined(MSG_NOSIGNAL)
+static constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static constexpr int SEND_FLAGS = 0;            // SO_NOSIGPIPE is set on the socket instead
+#endif
+
+static constexpr size_t MAX_CONTROL_CLIENTS = 16;
+static constexpr size_t MAX_COMMAND_BYTES = 4096;
+static constexpr size_t MAX_FIND_RESULTS = 50;
+
+static std::string lowercase(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::tolower(c); });
+    return s;
+}
+
+int daemon_loop(Node* root,
+                const std::string& base,
+                const std::string& token,
+                const PlayerSettings& settings,
+                const std::string& socket_path) {
+    // Undone on return, after the player and its threads are gone.
+    SignalPipe signals;
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.empty() || socket_path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Invalid control socket path: " << socket_path << std::endl;
+        return 1;
+    }
+    std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size());
+    ScopedFd listen_fd(socket(AF_UNIX, SOCK_STREAM, 0));
+    unlink(socket_path.c_str());
+    if (listen_fd.fd < 0 || !set_nonblocking(listen_fd.fd) || bind(listen_fd.fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+        || listen(listen_fd.fd, 8) != 0) {
+        std::cerr << "Cannot listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    chmod(socket_path.c_str(), 0600);
+
+    std::map<std::string, Node*> by_id;
+    std::vector<Node*> library;
+    collect_tracks(root, library);
+    for (Node* n : library) by_id[n->track->id] = n;
+
+    std::unique_ptr<AudioPlayer> player;
+    {
+        // The player's threads, and the ones they start, inherit a mask with
+        // both signals blocked, so the handler never interrupts their calls.
+        ScopedSignalMask mask(signals.signals());
+        player = std::make_unique<AudioPlayer>(settings);
+    }
+    int volume = 50;
+    player->set_volume(volume);
+    std::vector<Node*> queueList;
+    Node* playing_node = nullptr;
+    Node* loading_node = nullptr;
+    std::vector<std::string> sent_upcoming;
+    std::vector<ControlClient> clients;
+    DaemonStatus status;
+    bool running = true;
+
+    std::cout << "Listening on " << socket_path << " (" << library.size() << " tracks)" << std::endl;
+    if (!player->realtime_report().empty()) std::cout << "RT: " << player->realtime_report() << std::endl;
+
+    auto track_url = [&](Node* n) {
+        return stream_url(base, token, *n->track);
+    };
+
+    auto queued_index = [&](const std::string& url) -> size_t {
+        for (size_t i = 0; i < queueList.size(); ++i)
+            if (track_url(queueList[i]) == url) return i;
+        return queueList.size();
+    };
+
+    auto sync_upcoming = [&]() {
+        std::vector<std::string> urls;
+        for (size_t i = 0; i < queueList.size(); ++i) {
+            if (i == 0 && queueList[0] == playing_node) continue;
+            urls.push_back(track_url(queueList[i]));
+        }
+        if (urls != sent_upcoming) {
+            player->set_upcoming(urls);
+            sent_upcoming = std::move(urls);
+        }
+    };
+
+    auto play_node = [&](Node* n) {
+        player->play(track_url(n));
+        loading_node = n;
+    };
+
+    // Drops the finished head of the queue and starts the one after it.
+    auto advance = [&]() {
+        if (!queueList.empty() && queueList.front() == playing_node) queueList.erase(queueList.begin());
+        if (!queueList.empty()) {
+            play_node(queueList.front());
+        } else {
+            player->stop();
+            playing_node = nullptr;
+        }
+    };
+
+    // Same bookkeeping as the UI loop.
+    auto process_events = [&]() {
+        PlayerEvent ev;
+        while (player->poll_event(ev)) {
+            if (ev.type == PlayerEvent::STARTED) {
+                playing_node = loading_node;
+                loading_node = nullptr;
+                status.error.clear();
+            } else if (ev.type == PlayerEvent::ADVANCED) {
+                if (!queueList.empty() && queueList.front() == playing_node) queueList.erase(queueList.begin());
+                size_t qi = queued_index(ev.url);
+                playing_node = qi < queueList.size() ? queueList[qi] : nullptr;
+            } else if (loading_node && track_url(loading_node) == ev.url) {
+                status.error = loading_node->track->id;
+                loading_node = nullptr;
+            } else {
+                size_t qi = queued_index(ev.url);
+                if (qi < queueList.size()) {
+                    status.error = queueList[qi]->track->id;
+                    queueList.erase(queueList.begin() + qi);
+                }
+            }
+        }
+        if (player->is_track_finished()) advance();
+        sync_upcoming();
+    };
+
+    auto refresh_status = [&]() {
+        status.state = player->is_loading() ? "loading"
+                     : player->is_track_playing() ? "playing"
+                     : player->is_track_paused() ? "paused" : "stopped";
+        status.track = playing_node;
+        status.elapsed = player->elapsed_seconds();
+        status.length = player->length_seconds();
+        status.taken = std::chrono::steady_clock::now();
+        status.volume = volume;
+        status.queued = queueList.size();
+    };
+
+    auto describe = [](Node* n) {
+        return n->track->id + "\t" + n->parent->parent->name + " / " + n->parent->name + " / " + n->name + "\n";
+    };
+
+    auto handle = [&](ControlClient& client, const std::string& line) {
+        std::istringstream words(line);
+        std::string cmd, arg;
+        words >> cmd;
+        std::getline(words >> std::ws, arg);
+        std::string& out = client.out;
+
+        auto lookup = [&](const std::string& id) -> Node* {
+            auto it = by_id.find(id);
+            if (it == by_id.end()) out += "error: unknown track " + id + "\n";
+            return it == by_id.end() ? nullptr : it->second;
+        };
+
+        if (cmd == "status") {
+            double elapsed = status.elapsed;
+            if (std::strcmp(status.state, "playing") == 0) {
+                elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - status.taken).count();
+                if (status.length > 0) elapsed = std::min(elapsed, status.length);
+            }
+            char position[64];
+            snprintf(position, sizeof(position), "%.1f / %.1f", elapsed, status.length);
+            out += std::string("state: ") + status.state + "\n";
+            if (status.track) out += "track: " + describe(status.track);
+            out += std::string("position: ") + position + "\n";
+            out += "volume: " + std::to_string(status.volume) + "\n";
+            out += "eq: " + player->eq_preset_name(player->current_eq_preset()) + "\n";
+            out += "queue: " + std::to_string(status.queued) + "\n";
+            if (!status.error.empty()) out += "failed: " + status.error + "\n";
+        } else if (cmd == "play" && !arg.empty()) {
+            Node* n = lookup(arg);
+            if (!n) return;
+            play_node(n);
+        } else if (cmd == "pause") {
+            player->pause();
+        } else if (cmd == "resume") {
+            player->resume();
+        } else if (cmd == "toggle") {
+            if (player->is_track_paused()) player->resume();
+            else player->pause();
+        } else if (cmd == "next") {
+            advance();
+        } else if (cmd == "eq" && !arg.empty()) {
+            size_t i = 0;
+            while (i < player->eq_preset_count() && player->eq_preset_name(i) != arg) ++i;
+            if (i == player->eq_preset_count()) {
+                out += "error: unknown preset " + arg + "\n";
+                return;
+            }
+            player->set_eq_preset(i);
+        } else if (cmd == "volume" && !arg.empty()) {
+            volume = std::clamp(std::atoi(arg.c_str()), 0, 100);
+            player->set_volume(volume);
+        } else if (cmd == "queue") {
+            std::istringstream rest(arg);
+            std::string sub, id;
+            rest >> sub >> id;
+            if (sub == "add" && !id.empty()) {
+                Node* n = lookup(id);
+                if (!n) return;
+                queueList.push_back(n);
+                if (!playing_node && !loading_node && !player->is_loading()) play_node(n);
+            } else if (sub == "clear") {
+                queueList.erase(std::remove_if(queueList.begin(), queueList.end(),
+                                               [&](Node* n) { return n != playing_node; }),
+                                queueList.end());
+            } else if (sub == "list") {
+                for (Node* n : queueList) out += describe(n);
+            } else {
+                out += "error: usage: queue add <id> | queue clear | queue list\n";
+                return;
+            }
+        } else if (cmd == "find" && !arg.empty()) {
+            std::string needle = lowercase(arg);
+            size_t found = 0;
+            for (Node* n : library) {
+                if (found == MAX_FIND_RESULTS) break;
+                std::string hay = lowercase(n->parent->parent->name + " " + n->parent->name + " " + n->name);
+                if (hay.find(needle) != std::string::npos) {
+                    out += describe(n);
+                    ++found;
+                }
+            }
+        } else if (cmd == "quit") {
+            client.closing = true;
+        } else if (cmd == "shutdown") {
+            running = false;
+        } else {
+            out += "error: unknown command\n";
+            return;
+        }
+        sync_upcoming();
+        out += "ok\n";
+    };
+
+    auto flush = [](ControlClient& client) {
+        while (!client.out.empty()) {
+            ssize_t n = send(client.fd, client.out.data(), client.out.size(), SEND_FLAGS);
+            if (n <= 0) {
+                if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+                client.out.clear();
+                client.closing = true;
+                return;
+            }
+            client.out.erase(0, static_cast<size_t>(n));
+        }
+    };
+
+    std::vector<pollfd> fds;
+    while (running) {
+        process_events();
+        refresh_status();
+
+        // Nothing audible: stop the device too, so an idle daemon sleeps
+        // in poll() with no periodic wakeups at all.
+        bool idle = !player->is_loading() && !player->is_track_playing();
+        if (idle) player->suspend_output();
+
+        fds.clear();
+        fds.push_back({signals.fd(), POLLIN, 0});
+        fds.push_back({listen_fd.fd, POLLIN, 0});
+        for (auto& c : clients) fds.push_back({c.fd, short(POLLIN | (c.out.empty() ? 0 : POLLOUT)), 0});
+        int timeout = idle ? -1 : player->is_loading() ? 50 : 250;
+        if (poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) break;
+
+        if ((fds[0].revents & POLLIN) && signals.take()) running = false;
+        if (fds[1].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(listen_fd.fd, nullptr, nullptr)) >= 0) {
+                if (clients.size() >= MAX_CONTROL_CLIENTS || !set_nonblocking(fd)) {
+                    close(fd);
+                    continue;
+                }
+#if defined(SO_NOSIGPIPE)
+                int one = 1;
+                setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+                clients.push_back({fd, "", "", false});
+            }
+        }
+        for (size_t i = 0; i < clients.size(); ++i) {
+            ControlClient& c = clients[i];
+            short revents = fds[i + 2].revents;
+            if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                char buf[1024];
+                ssize_t n;
+                while ((n = recv(c.fd, buf, sizeof(buf), 0)) > 0) c.in.append(buf, static_cast<size_t>(n));
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) c.closing = true;
+                size_t nl;
+                while ((nl = c.in.find('\n')) != std::string::npos) {
+                    std::string line = c.in.substr(0, nl);
+                    c.in.erase(0, nl + 1);
+                    if (!line.empty() && line.back() == '\r') line.pop_back();
+                    if (!line.empty()) handle(c, line);
+                }
+                if (c.in.size() > MAX_COMMAND_BYTES) c.closing = true;
+            }
+            flush(c);
+        }
+        clients.erase(std::remove_if(clients.begin(), clients.end(), [](const ControlClient& c) {
+                          if (!c.closing || !c.out.empty()) return false;
+                          close(c.fd);
+                          return true;
+                      }),
+                      clients.end());
+    }
+
+    for (auto& c : clients) close(c.fd);
+    unlink(socket_path.c_str());
+    print_diagnostics(*player);
+    return 0;
 }
 
-int main(){
+int main(int argc, char** argv){
+    if (argc > 1 && std::string(argv[1]) == "--self-test") return self_test();
+    bool daemon = argc > 1 && std::string(argv[1]) == "--daemon";
+    bool bench = argc > 1 && std::string(argv[1]) == "--bench-library";
     curl_global_init(CURL_GLOBAL_DEFAULT);
     std::string cfg = "aitunes_config.json";
     json cfgj = load_config(cfg);
+    PlayerSettings settings = load_player_settings(cfgj);
     std::cout << "AITUNES v" << VERSION << std::endl;
     auto [token,user,base] = authenticate(cfgj);
+    if (bench) {
+        int rc = bench_library(base, token, user);
+        curl_global_cleanup();
+        return rc;
+    }
     std::cout << "🕪 Loading Tracks, please wait..." << std::endl;
     auto tracks = fetch_tracks(base,token,user);
     auto root = build_tree(tracks);
-    ui_loop(root.get(),base,token);
+    if (daemon) {
+        int rc = daemon_loop(root.get(), base, token, settings, cfgj.value("control_socket", "aitunes.sock"));
+        curl_global_cleanup();
+        return rc;
+    }
+    ui_loop(root.get(),base,token,settings);
     curl_global_cleanup();
     std::cout << "Thanks for vibing, goodbye." << std::endl;
     return 0;
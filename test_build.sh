@@ -32,6 +32,15 @@ if [ -f "dist/aitunes" ]; then
     else
         echo "ldd not available, skipping dependency check"
     fi
+
+    # Check the signal path against known answers
+    echo "Running self-test..."
+    if ./dist/aitunes --self-test; then
+        echo "✅ Self-test passed"
+    else
+        echo "❌ Self-test failed"
+        exit 1
+    fi
     
 else
     echo "❌ Build failed! Binary not found at dist/aitunes"